@@ -49,9 +49,158 @@ sockaddr_in find_server() {
     return server_addr;
 }
 
+// blocks until all of `len` has arrived, false if the connection ends first
+bool recv_all(
+    int sock_fd,
+    void* buffer,
+    size_t len
+) {
+    char* iter = (char*)buffer;
+
+    while (len != 0) {
+        int ret = recv(sock_fd, iter, len, 0);
+
+        if (ret <= 0) {
+            return false;
+        }
+
+        iter += ret;
+        len -= ret;
+    }
+
+    return true;
+}
+
+// turns a typed command into a frame, arguments in the same order as the
+// text protocol. false if it does not parse
+bool frame_encode(
+    const char* line,
+    uint32_t request_id,
+    char* frame,
+    size_t* pframe_len
+) {
+    char verb[16];
+    char symbol[64];
+    char first[64];
+    char second[64];
+    int user_id = 1;
+    fixed_t amount;
+    fixed_t price;
+    int arg_count;
+
+    frame_header_t header = { .request_id = htole32(request_id) };
+    size_t body_len = 0;
+
+    if (sscanf(line, "%15s", verb) != 1) {
+        return false;
+    }
+
+    if (strcasecmp(verb, "buy") == 0 || strcasecmp(verb, "sell") == 0) {
+        bool sell = tolower(verb[0]) == 's';
+
+        arg_count = sscanf(line, "%*s %63s %63s %63s %d", symbol, first, second, &user_id);
+
+        // buy takes the amount first, sell the price
+        if (arg_count != 4 || strlen(symbol) > FRAME_SYMBOL_LEN || 
+            !fixed_parse(sell ? second : first, &amount) || !fixed_parse(sell ? first : second, &price)) {
+            return false;
+        }
+
+        frame_trade_t trade = {
+            .amount = htole64(amount),
+            .price = htole64(price),
+            .user_id = htole32(user_id),
+        };
+
+        memcpy(trade.symbol, symbol, strlen(symbol));
+
+        header.opcode = htole16(sell ? OP_SELL : OP_BUY);
+        body_len = sizeof(trade);
+        memcpy(frame + sizeof(header), &trade, sizeof(trade));
+    } else if (strcasecmp(verb, "list") == 0 || strcasecmp(verb, "balance") == 0) {
+        arg_count = sscanf(line, "%*s %d", &user_id);
+
+        frame_user_t user = { .user_id = htole32(user_id) };
+
+        header.opcode = htole16(tolower(verb[0]) == 'l' ? OP_LIST : OP_BALANCE);
+        body_len = sizeof(user);
+        memcpy(frame + sizeof(header), &user, sizeof(user));
+    } else if (strcasecmp(verb, "shutdown") == 0) {
+        header.opcode = htole16(OP_SHUTDOWN);
+    } else if (strcasecmp(verb, "quit") == 0) {
+        header.opcode = htole16(OP_QUIT);
+    } else {
+        return false;
+    }
+
+    header.length = htole32(body_len);
+    memcpy(frame, &header, sizeof(header));
+
+    *pframe_len = sizeof(header) + body_len;
+
+    return true;
+}
+
+// prints one reply frame the way the text protocol would have put it
+bool frame_print(
+    int sock_fd
+) {
+    frame_header_t header;
+    char amount[FIXED_TEXT_MAX];
+
+    if (!recv_all(sock_fd, &header, sizeof(header))) {
+        return false;
+    }
+
+    // a list reply grows with the holdings, it is sized by its header alone
+
+    uint32_t body_len = le32toh(header.length);
+    char* body = (char*)malloc(body_len + 1);
+
+    if (body == NULL || !recv_all(sock_fd, body, body_len)) {
+        free(body);
+        return false;
+    }
+
+    printf("--> #%u %d", le32toh(header.request_id), (int)le16toh(header.status));
+
+    if (le16toh(header.opcode) == OP_BALANCE && body_len == sizeof(frame_balance_t)) {
+        frame_balance_t balance;
+        memcpy(&balance, body, sizeof(balance));
+
+        printf("\nBalance = %.*s", (int)fixed_format(le64toh(balance.balance), amount), amount);
+    }
+
+    for (size_t off = 0; le16toh(header.opcode) == OP_LIST && off + sizeof(frame_holding_t) <= body_len; ) {
+        frame_holding_t holding;
+        memcpy(&holding, body + off, sizeof(holding));
+
+        int symbol_len = le16toh(holding.symbol_len);
+        off += sizeof(holding);
+
+        printf("\n%.*s : %.*s", symbol_len, body + off, 
+            (int)fixed_format(le64toh(holding.balance), amount), amount);
+
+        off += symbol_len;
+    }
+
+    printf("\n");
+    free(body);
+
+    return true;
+}
+
 int main(int argc, char** argv) {
 
     sockaddr_in server_addr;
+    bool binary = false;
+
+    // -b talks frames instead of text, see shared.h
+    if (argc >= 2 && strcmp(argv[1], "-b") == 0) {
+        binary = true;
+        argc--;
+        argv++;
+    }
 
     if (argc >= 2) {
         if (inet_pton(AF_INET, argv[1], &(server_addr.sin_addr)) != 1) {
@@ -77,25 +226,82 @@ int main(int argc, char** argv) {
 
     char send_buffer[1024] = { }; 
     char recv_buffer[1024] = { }; 
+    char tagged_buffer[1024 + 16];
+    uint32_t request_id = 0;
 
-    while (true) {
-        printf("<-- ");
-        fgets(send_buffer, LENGTHOF(send_buffer), stdin);
+    if (binary) {
+        char reply;
 
-        size_t len = strcspn(send_buffer, "\n");
+        send(sock_fd, "binary\n", 7, 0);
+
+        // the switch is answered in text, frames follow it
+        while (recv(sock_fd, &reply, 1, 0) == 1 && reply != MAGIC_EOR) {
+            // nothing, the reply is always 200 OK
+        }
+    }
+
+    // every request carries a tag the reply echoes, so requests go out as they
+    // are typed and replies are printed whenever they arrive
+
+    struct pollfd fds[2] = {
+        { .fd = STDIN_FILENO, .events = POLLIN },
+        { .fd = sock_fd, .events = POLLIN },
+    };
+
+    printf("<-- ");
+    fflush(stdout);
+
+    while (poll(fds, LENGTHOF(fds), -1) > 0) {
+        if (fds[1].revents != 0) {
+            if (binary) {
+                if (!frame_print(sock_fd)) {
+                    goto exit;
+                }
+            } else {
+                int ret = recv(sock_fd, recv_buffer, LENGTHOF(recv_buffer), 0);
+
+                if (ret <= 0) {
+                    goto exit;
+                }
+
+                printf("--> %.*s\n", ret, recv_buffer);
+            }
+        }
 
+        if (fds[0].revents == 0) {
+            continue;
+        }
+
+        // out of input, quit is answered after everything sent before it and
+        // the server hangs up once it has
+
+        if (fgets(send_buffer, LENGTHOF(send_buffer), stdin) == NULL) {
+            strcpy(send_buffer, "quit");
+            fds[0].fd = -1;
+        }
+
+        size_t len = strcspn(send_buffer, "\n");
         send_buffer[len] = '\0';
-        fflush(stdin);
 
-        if (len != 0) {
-            int ret = send(sock_fd, send_buffer, strlen(send_buffer), 0);
-            ret = recv(sock_fd, recv_buffer, LENGTHOF(recv_buffer), 0);
+        if (len != 0 && binary) {
+            char frame[sizeof(frame_header_t) + FRAME_MAX_BODY];
+            size_t frame_len;
 
-            if (ret <= 0) {
-                // stuff
+            if (frame_encode(send_buffer, ++request_id, frame, &frame_len)) {
+                send(sock_fd, frame, frame_len, 0);
+            } else {
+                printf("--> Not A Command\n");
             }
+        } else if (len != 0) {
+            // the server splits commands on newlines
+            int tagged_len = snprintf(tagged_buffer, LENGTHOF(tagged_buffer), "#%u %s\n", ++request_id, send_buffer);
+
+            send(sock_fd, tagged_buffer, tagged_len, 0);
+        }
 
-            printf("--> %.*s\n", ret, recv_buffer);
+        if (fds[0].fd != -1) {
+            printf("<-- ");
+            fflush(stdout);
         }
     }
 
@@ -6,6 +6,16 @@ There are not comments describing every line, nor should there be.
 
 #include "shared.h"
 
+// the io_uring backend is written against the 6.0 uapi, the single issuer
+// flag marks it as SEND_ZC is an enum. older headers build epoll alone
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+
+#ifdef IORING_SETUP_SINGLE_ISSUER
+#define HAVE_IO_URING
+#endif
+
 #define CODE_200 "200 OK\x1"
 #define CODE_400 "400 Invalid Command\x1"
 #define CODE_401 "401 User Does Not Exist\x1"
@@ -13,80 +23,464 @@ There are not comments describing every line, nor should there be.
 #define CODE_403 "403 Message Format Error\x1"
 #define CODE_404 "404 Insufficient Stock Balance\x1"
 
-#define USERS_CREATE_QUERY "CREATE TABLE IF NOT EXISTS Users(ID INTEGER PRIMARY KEY AUTOINCREMENT,first_name TEXT,last_name TEXT,user_name TEXT NOT NULL,password TEXT,usd_balance DOUBLE NOT NULL);"
+#define USERS_CREATE_QUERY "CREATE TABLE IF NOT EXISTS Users(ID INTEGER PRIMARY KEY AUTOINCREMENT,first_name TEXT,last_name TEXT,user_name TEXT NOT NULL,password TEXT,usd_balance INTEGER NOT NULL);"
 #define USERS_EMPTY_QUERY "SELECT COUNT(*) FROM (select 0 from Users limit 1)"
-#define USERS_COUNT_QUERY "SELECT COUNT(*) FROM Users"
 #define USERS_INSERT_QUERY "INSERT INTO Users (first_name, last_name, user_name, password, usd_balance) VALUES (?1, ?2, ?3, ?4, ?5)"
-#define USERS_BALANCE_QUERY "SELECT usd_balance FROM Users WHERE ID = ?1"
-#define USERS_UPDATE_BALANCE_QUERY "UPDATE Users SET usd_balance = ?1 WHERE id = ?2"
+#define USERS_LOAD_QUERY "SELECT ID, usd_balance FROM Users"
+#define USERS_DEBIT_BALANCE_QUERY "UPDATE Users SET usd_balance = usd_balance - ?1 WHERE ID = ?2 AND usd_balance >= ?1"
+#define USERS_CREDIT_BALANCE_QUERY "UPDATE Users SET usd_balance = usd_balance + ?1 WHERE ID = ?2"
+
+#define STOCKS_CREATE_QUERY "CREATE TABLE IF NOT EXISTS Stocks(ID INTEGER PRIMARY KEY AUTOINCREMENT,stock_symbol VARCHAR(4) NOT NULL,stock_name VARCHAR(20),stock_balance INTEGER NOT NULL DEFAULT 0,user_id INTEGER,FOREIGN KEY (user_id) REFERENCES Users (ID));"
+#define STOCKS_DEDUP_QUERY "UPDATE Stocks SET stock_balance = (SELECT SUM(s.stock_balance) FROM Stocks s WHERE s.user_id = Stocks.user_id AND s.stock_symbol = Stocks.stock_symbol) WHERE ID IN (SELECT MIN(ID) FROM Stocks GROUP BY user_id, stock_symbol HAVING COUNT(*) > 1); DELETE FROM Stocks WHERE ID NOT IN (SELECT MIN(ID) FROM Stocks GROUP BY user_id, stock_symbol);"
+#define STOCKS_UNIQUE_QUERY "CREATE UNIQUE INDEX IF NOT EXISTS Stocks_user_symbol ON Stocks(user_id, stock_symbol);"
+#define STOCKS_CREDIT_QUERY "INSERT INTO Stocks (stock_symbol, stock_balance, user_id) VALUES (?1, ?2, ?3) ON CONFLICT(user_id, stock_symbol) DO UPDATE SET stock_balance = stock_balance + excluded.stock_balance"
+#define STOCKS_DEBIT_QUERY "UPDATE Stocks SET stock_balance = stock_balance - ?1 WHERE user_id = ?2 AND stock_symbol = ?3 AND stock_balance >= ?1"
+#define STOCKS_LOAD_QUERY "SELECT user_id, stock_symbol, stock_balance FROM Stocks ORDER BY ID"
+
+#define USERS_FIXED_QUERY "CREATE TABLE Users_fixed(ID INTEGER PRIMARY KEY AUTOINCREMENT,first_name TEXT,last_name TEXT,user_name TEXT NOT NULL,password TEXT,usd_balance INTEGER NOT NULL); INSERT INTO Users_fixed SELECT ID, first_name, last_name, user_name, password, CAST(ROUND(usd_balance * 1000000) AS INTEGER) FROM Users; DROP TABLE Users; ALTER TABLE Users_fixed RENAME TO Users;"
+#define STOCKS_FIXED_QUERY "CREATE TABLE Stocks_fixed(ID INTEGER PRIMARY KEY AUTOINCREMENT,stock_symbol VARCHAR(4) NOT NULL,stock_name VARCHAR(20),stock_balance INTEGER NOT NULL DEFAULT 0,user_id INTEGER,FOREIGN KEY (user_id) REFERENCES Users (ID)); INSERT INTO Stocks_fixed SELECT ID, stock_symbol, stock_name, CAST(ROUND(COALESCE(stock_balance, 0) * 1000000) AS INTEGER), user_id FROM Stocks; DROP TABLE Stocks; ALTER TABLE Stocks_fixed RENAME TO Stocks; " STOCKS_UNIQUE_QUERY
 
-#define STOCKS_CREATE_QUERY "CREATE TABLE IF NOT EXISTS Stocks(ID INTEGER PRIMARY KEY AUTOINCREMENT,stock_symbol VARCHAR(4) NOT NULL,stock_name VARCHAR(20),stock_balance DOUBLE,user_id INTEGER,FOREIGN KEY (user_id) REFERENCES Users (ID));"
-#define STOCKS_INSERT_QUERY "INSERT INTO Stocks (stock_symbol, stock_balance, user_id) VALUES (?1, ?2, ?3)"
-#define STOCKS_COUNT_QUERY "SELECT COUNT(*) FROM Stocks WHERE user_id = ?1 AND stock_symbol = ?2"
-#define STOCKS_BALANCE_QUERY "SELECT stock_balance FROM Stocks WHERE user_id = ?1 AND stock_symbol = ?2"
-#define STOCKS_UPDATE_BALANCE_QUERY "UPDATE Stocks SET stock_balance = ?1 WHERE user_id = ?2 AND stock_symbol = ?3"
-#define STOCKS_LIST_QUERY "SELECT stock_symbol, stock_balance FROM Stocks WHERE user_id = ?1"
+#define SCHEMA_EMPTY_QUERY "SELECT COUNT(*) FROM sqlite_master WHERE type = 'table'"
+#define VERSION_QUERY "PRAGMA user_version"
+
+#define BEGIN_QUERY "BEGIN IMMEDIATE"
+#define COMMIT_QUERY "COMMIT"
 
 //
 // Structures
 //
 
+// responses queue up in chunks, appends fill the tail chunk while the head
+// drains to the socket
+typedef struct _out_chunk_t {
+    struct _out_chunk_t* next;
+    size_t len;
+    size_t off;
+    size_t cap;
+    char data[];
+} out_chunk_t;
+
+// scheduled on the reactor that armed it, see timer_arm
+typedef struct _event_timer_t {
+    uint64_t deadline_us;
+    bool armed;
+    int slot;
+    void(*callback)(void*);
+    void* arg;
+} event_timer_t;
+
 typedef struct _client_t {
     int sock_fd;
+    bool closed;
+    int inflight;
     sockaddr_in addr;
+    char* in_buffer;
+    size_t in_len;
+    size_t in_cap;
+    size_t in_scan;
+    out_chunk_t* out_head;
+    out_chunk_t* out_tail;
+    size_t out_bytes;
+    bool out_busy;
+    bool paused;
+    bool recv_armed;
+    bool flush_queued;
+    bool binary;
+    uint64_t hold_epoch;
+    struct _client_t* flush_next;
     struct _client_t* next;
-    struct _client_t* prev;
+    uint64_t last_active_us;
+    event_timer_t idle_timer;
+    int slot;
+    uint32_t generation;
+    bool in_use;
 } client_t;
 
+typedef struct _holding_t {
+    char* symbol;
+    fixed_t balance;
+} holding_t;
+
+typedef struct _account_t {
+    bool exists;
+    fixed_t balance;
+    holding_t* holdings;
+    int holding_count;
+    int holding_cap;
+    uint64_t epoch; // the journal epoch of its last trade, under its lane
+} account_t;
+
+// accounts are split across lanes by user id, a lane serializes the commands
+// of its users. padded so that lanes busy on different cores share no line
+typedef struct _lane_t {
+    pthread_mutex_t lock;
+} __attribute__((aligned(64))) lane_t;
+
+// one trade waiting to be written through to SQLite
+typedef struct _journal_entry_t {
+    struct _journal_entry_t* next;
+    bool sell;
+    int user_id;
+    fixed_t amount;
+    fixed_t cost;
+    char symbol[];
+} journal_entry_t;
+
+#define LOG_TEXT_SIZE 240
+#define LOG_RING_SLOTS 1024
+
+// one line of log output, addr is printed in place of ns when ns is NULL
+typedef struct _log_record_t {
+    const char* ns;
+    struct in_addr addr;
+    int len;
+    char text[LOG_TEXT_SIZE];
+} log_record_t;
+
+// single producer single consumer, the producer being the owning thread
+typedef struct _log_ring_t {
+    struct _log_ring_t* next;
+    atomic_uint head;
+    atomic_uint tail;
+    atomic_uint dropped;
+    unsigned sample;
+    log_record_t records[LOG_RING_SLOTS];
+} log_ring_t;
+
 typedef void(*command_callback)(
     client_t*,  // client
     const char* // input
 );
 
 typedef struct _command_t {
-    const char* prefix;
+    const char* verb;
     command_callback callback;
+    size_t verb_len;
 } command_t;
 
+typedef void(*frame_callback)(
+    client_t*,             // client
+    const frame_header_t*, // request, in host order
+    const char*            // body
+);
+
+typedef struct _frame_command_t {
+    frame_callback callback;
+    uint32_t body_len;
+} frame_command_t;
+
+#ifdef HAVE_IO_URING
+typedef struct _uring_t {
+    int fd;
+    void* ring_ptr;
+    size_t ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned sq_entries;
+    unsigned sq_mask;
+    unsigned sq_tail;
+    unsigned* ksq_head;
+    unsigned* ksq_tail;
+    unsigned cq_mask;
+    unsigned* kcq_head;
+    unsigned* kcq_tail;
+    struct io_uring_cqe* cqes;
+    struct io_uring_buf_ring* buf_ring;
+    unsigned short buf_tail;
+    char* bufs;
+    struct iovec* iovs;
+} uring_t;
+#endif
+
+// one event loop thread, each owns a SO_REUSEPORT listener and its clients
+typedef struct _reactor_t {
+    int id;
+    pthread_t thread;
+    int server_fd;
+    int wake_fd;
+    atomic_uint_fast64_t waiting_epoch;
+} reactor_t;
+
+// connections open from one source address, a count of zero marks a free slot
+typedef struct _addr_count_t {
+    in_addr_t addr;
+    int count;
+} addr_count_t;
+
+// one step of the schema, applied in order and counted in user_version
+typedef struct _migration_t {
+    const char* name;
+    const char* query;
+} migration_t;
+
+typedef struct _statement_t {
+    sqlite3_stmt** pstatement;
+    const char* query;
+} statement_t;
+
+// how the database trades durability for speed, picked once at startup
+typedef struct _profile_t {
+    const char* name;
+    const char* journal_mode;
+    const char* synchronous;
+    int cache_size;
+    int64_t mmap_size;
+    const char* temp_store;
+} profile_t;
+
+// the I/O path the event loop is built on, picked once at startup
+typedef struct _backend_t {
+    const char* name;
+    bool(*init)();
+    void(*deinit)();
+    void(*run)();
+    bool(*attach)(client_t*);
+    void(*detach)(client_t*);
+    void(*flush)(client_t*);
+    void(*pause)(client_t*);
+    void(*resume)(client_t*);
+} backend_t;
+
 //
 // Declarations
 //
 
+log_ring_t* log_ring();
+void vlog_write(int, const char*, const sockaddr_in*, const char*, va_list);
+void log_write(int, const char*, const sockaddr_in*, const char*, ...);
+size_t log_drain();
+void log_start();
+void log_stop();
+
 void buy_command(client_t*, const char*);
 void sell_command(client_t*, const char*);
 void list_command(client_t*, const char*);
 void balance_command(client_t*, const char*);
 void shutdown_command(client_t*, const char*);
 void quit_command(client_t*, const char*);
-
-void db_add_user(const char*, const char*, const char*, const char*, double);
-double db_get_balance(int);
-void db_set_balance(int, double);
-int db_user_count();
-bool db_has_stock(int, const char*);
-void db_add_stock(int, const char*, double);
-double db_get_stock_balance(int, const char*);
-void db_set_stock_balance(int, const char*, double);
-int db_list_stock(int, char**, double*, int);
+void binary_command(client_t*, const char*);
+int batch_leg(account_t*, int, const char*, size_t, journal_entry_t**);
+void batch_command(client_t*, const char*);
+void frame_buy(client_t*, const frame_header_t*, const char*);
+void frame_sell(client_t*, const frame_header_t*, const char*);
+void frame_list(client_t*, const frame_header_t*, const char*);
+void frame_balance(client_t*, const frame_header_t*, const char*);
+void frame_shutdown(client_t*, const frame_header_t*, const char*);
+void frame_quit(client_t*, const frame_header_t*, const char*);
+uint32_t command_hash(const char*, size_t, uint32_t);
+void command_index();
+command_t* command_find(const char*, size_t);
+
+void db_add_user(const char*, const char*, const char*, const char*, fixed_t);
+bool db_debit_balance(int, fixed_t);
+void db_credit_balance(int, fixed_t);
+bool db_has_users();
+bool db_debit_stock(int, const char*, fixed_t);
+void db_credit_stock(int, const char*, fixed_t);
+void db_begin();
+void db_commit();
+void db_pragma(const char*, ...);
+int db_scalar(const char*);
+void db_upgrade(const char*, int);
+void db_migrate();
+void db_open(const char*, const profile_t*);
+void db_close();
+
+account_t* store_account(int);
+account_t* store_enter(int);
+void store_leave(int);
+int store_trade(account_t*, int, bool, const char*, fixed_t, fixed_t, journal_entry_t**);
+void store_untrade(account_t*, const journal_entry_t*);
+int store_take(int, bool, const char*, fixed_t, fixed_t);
+void store_add_user(int, fixed_t);
+holding_t* store_holding(account_t*, const char*, bool);
+void store_load();
+void store_free();
+journal_entry_t* journal_entry(bool, int, const char*, fixed_t, fixed_t);
+void journal_append(journal_entry_t*);
+void journal_apply(journal_entry_t*);
+void journal_start();
+void journal_wait();
+void journal_stop();
+
+uint64_t monotonic_us();
+void timer_arm(event_timer_t*, uint64_t);
+void timer_cancel(event_timer_t*);
+int64_t timer_run();
+void heartbeat(void*);
 
 void client_handle(client_t*, const char*, size_t);
+client_t* client_alloc();
+void client_release(client_t*);
+uint64_t client_ref(client_t*);
+client_t* client_lookup(uint64_t);
+bool client_admit(const sockaddr_in*);
+void client_discharge(const sockaddr_in*);
+void client_idle(void*);
 void client_accept(int, const sockaddr_in*);
+void client_event(client_t*, uint32_t);
 void client_remove(client_t*);
 void client_send(client_t*, const char*, ...);
 void client_recv(client_t*);
+void client_process(client_t*);
+void client_ingest(client_t*, const char*, size_t);
+void client_queue(client_t*, const char*, size_t);
+void client_send_fixed(client_t*, fixed_t);
+void client_send_status(client_t*, int);
+void client_send_frame(client_t*, const frame_header_t*, int, const void*, uint32_t);
+size_t client_process_frames(client_t*, size_t);
+void client_handle_frame(client_t*, const frame_header_t*, const char*);
+char* client_out_space(client_t*, size_t);
+void client_out_commit(client_t*, size_t);
+void client_wrote(client_t*, size_t);
+int client_iov(client_t*, struct iovec*, int);
+void client_free(client_t*);
+bool client_held(client_t*);
+
+// constant replies are copied straight in, their length known at compile time
+#define client_send_code(_pclient, _code) client_queue((_pclient), (_code), sizeof(_code) - 1)
+
+void reactor_wake(reactor_t*);
+void reactor_wake_all();
+void reactor_wake_durable(uint64_t);
+void reactor_drain_wake();
+void reactor_flush();
+void reactor_begin_pass();
+int64_t reactor_end_pass();
+
+bool epoll_init();
+void epoll_deinit();
+void epoll_run();
+bool epoll_attach(client_t*);
+void epoll_detach(client_t*);
+void epoll_flush(client_t*);
+void epoll_pause(client_t*);
+void epoll_resume(client_t*);
+
+#ifdef HAVE_IO_URING
+bool uring_init();
+void uring_deinit();
+void uring_run();
+bool uring_attach(client_t*);
+void uring_detach(client_t*);
+void uring_flush(client_t*);
+void uring_pause(client_t*);
+void uring_resume(client_t*);
+#endif
 
 //
 // State / Global Variables
 //
 
-bool RUNNING;
+atomic_bool RUNNING;
 
 sqlite3* DATABASE;
-client_t* CLIENT_LIST;
+pthread_mutex_t DATABASE_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+// prepared once at startup, reset and rebound on every use
+sqlite3_stmt* USERS_EMPTY_STMT;
+sqlite3_stmt* USERS_INSERT_STMT;
+sqlite3_stmt* USERS_LOAD_STMT;
+sqlite3_stmt* USERS_DEBIT_BALANCE_STMT;
+sqlite3_stmt* USERS_CREDIT_BALANCE_STMT;
+sqlite3_stmt* STOCKS_CREDIT_STMT;
+sqlite3_stmt* STOCKS_DEBIT_STMT;
+sqlite3_stmt* STOCKS_LOAD_STMT;
+sqlite3_stmt* BEGIN_STMT;
+sqlite3_stmt* COMMIT_STMT;
+
+// the authoritative accounts, indexed by user id. SQLite trails behind them
+// through the journal, which a flusher thread commits in batches. entries
+// appended between two flushes share an epoch, replies wait until theirs is durable
+account_t* ACCOUNTS;
+int ACCOUNT_COUNT;
+
+lane_t* LANES;
+int LANE_COUNT;
+
+journal_entry_t* JOURNAL_HEAD;
+journal_entry_t** JOURNAL_TAIL = &JOURNAL_HEAD;
+uint64_t JOURNAL_EPOCH = 1;
+atomic_uint_fast64_t JOURNAL_LAST;
+atomic_uint_fast64_t JOURNAL_DURABLE;
+int64_t JOURNAL_WINDOW_US;
+bool JOURNAL_STOP;
+pthread_t JOURNAL_THREAD;
+pthread_cond_t JOURNAL_COND = PTHREAD_COND_INITIALIZER;
+pthread_cond_t JOURNAL_DURABLE_COND = PTHREAD_COND_INITIALIZER;
+
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+
+const char* LOG_LEVELS[] = { "debug", "info", "warn" };
+
+int LOG_LEVEL = LOG_INFO;
+int LOG_SAMPLE = 1;
+
+_Atomic(log_ring_t*) LOG_RINGS;
+atomic_bool LOG_ACTIVE;
+atomic_bool LOG_STOP;
+int LOG_WAKE_FD = -1;
+pthread_t LOG_THREAD;
 
-int SERVER_FD;
 int BROADCAST_FD;
 
+reactor_t* REACTORS;
+int REACTOR_COUNT;
+
+// state owned by the reactor running on this thread
+
+__thread reactor_t* REACTOR;
+__thread log_ring_t* LOG_RING;
+__thread client_t** CLIENT_PAGES;
+__thread int CLIENT_PAGE_COUNT;
+__thread client_t* CLIENT_FREE;
+__thread client_t* FLUSH_LIST;
+__thread uint64_t LOOP_NOW_US;
+__thread uint64_t ACCEPT_TAT;
+__thread client_t* CLOSED_LIST;
+__thread client_t* HELD_LIST;
+__thread uint64_t STORE_EPOCH;
+__thread int EPOLL_FD;
+#ifdef HAVE_IO_URING
+__thread uring_t URING = { .fd = -1 };
+#endif
+
+// a min-heap on deadline_us, each reactor only runs its own timers
+__thread event_timer_t** TIMERS;
+__thread int TIMER_COUNT;
+__thread int TIMER_CAP;
+
+// runs on the first reactor, the rest have no use for a broadcast
+event_timer_t HEARTBEAT_TIMER = { .callback = heartbeat };
+
+// connection limits, zero leaves one off
+int MAX_CLIENTS;
+int MAX_CLIENTS_PER_ADDR;
+int ACCEPT_RATE;
+int64_t IDLE_TIMEOUT_US;
+
+atomic_int CLIENT_TOTAL;
+
+// clients per source address, only kept with -M. open addressed with linear
+// probing, at most half full. accepts are rare next to commands, one lock does
+addr_count_t* ADDR_TABLE;
+size_t ADDR_CAP;
+size_t ADDR_USED;
+pthread_mutex_t ADDR_LOCK = PTHREAD_MUTEX_INITIALIZER;
+
+#define COMMAND_SLOTS 64
+#define MAX_VERB_LEN 16
+#define MAX_TAG_LEN 32
+#define BATCH_MAX_LEGS 1024
+
+// COMMANDS placed by command_hash, the seed is picked at startup so that no
+// two verbs share a slot
+command_t* COMMAND_TABLE[COMMAND_SLOTS];
+uint32_t COMMAND_SEED;
+
+// verbs are matched whole and without regard to case, see command_find
 command_t COMMANDS[] = {
     { "buy",      buy_command      },
     { "sell",     sell_command     },
@@ -94,611 +488,3338 @@ command_t COMMANDS[] = {
     { "balance",  balance_command  },
     { "shutdown", shutdown_command },
     { "quit",     quit_command     },
+    { "binary",   binary_command   },
+    { "batch",    batch_command    },
+};
+
+// indexed by opcode, a body must be exactly body_len bytes
+frame_command_t FRAME_COMMANDS[OP_COUNT] = {
+    [OP_BUY]      = { frame_buy,      sizeof(frame_trade_t) },
+    [OP_SELL]     = { frame_sell,     sizeof(frame_trade_t) },
+    [OP_LIST]     = { frame_list,     sizeof(frame_user_t)  },
+    [OP_BALANCE]  = { frame_balance,  sizeof(frame_user_t)  },
+    [OP_SHUTDOWN] = { frame_shutdown, 0                     },
+    [OP_QUIT]     = { frame_quit,     0                     },
+};
+
+// append only, a database records how many of these it has had
+migration_t MIGRATIONS[] = {
+    { "Merge Duplicate Holdings", STOCKS_DEDUP_QUERY  },
+    { "Index Holdings",           STOCKS_UNIQUE_QUERY },
+    { "Fixed Point Balances",     USERS_FIXED_QUERY   },
+    { "Fixed Point Holdings",     STOCKS_FIXED_QUERY  },
+};
+
+statement_t STATEMENTS[] = {
+    { &USERS_EMPTY_STMT,          USERS_EMPTY_QUERY          },
+    { &USERS_INSERT_STMT,         USERS_INSERT_QUERY         },
+    { &USERS_LOAD_STMT,           USERS_LOAD_QUERY           },
+    { &USERS_DEBIT_BALANCE_STMT,  USERS_DEBIT_BALANCE_QUERY  },
+    { &USERS_CREDIT_BALANCE_STMT, USERS_CREDIT_BALANCE_QUERY },
+    { &STOCKS_CREDIT_STMT,        STOCKS_CREDIT_QUERY        },
+    { &STOCKS_DEBIT_STMT,         STOCKS_DEBIT_QUERY         },
+    { &STOCKS_LOAD_STMT,          STOCKS_LOAD_QUERY          },
+    { &BEGIN_STMT,                BEGIN_QUERY                },
+    { &COMMIT_STMT,               COMMIT_QUERY               },
+};
+
+backend_t BACKENDS[] = {
+    { "epoll",    epoll_init, epoll_deinit, epoll_run, epoll_attach, epoll_detach, epoll_flush, epoll_pause, epoll_resume },
+#ifdef HAVE_IO_URING
+    { "io_uring", uring_init, uring_deinit, uring_run, uring_attach, uring_detach, uring_flush, uring_pause, uring_resume },
+#endif
+};
+
+backend_t* BACKEND;
+
+// cache_size is in pages when positive, KiB when negative, as SQLite takes it
+profile_t PROFILES[] = {
+    { "durable",  "WAL",    "FULL",   -16384, 0,         "DEFAULT" },
+    { "balanced", "WAL",    "NORMAL", -65536, 268435456, "MEMORY"  },
+    { "bench",    "MEMORY", "OFF",    -65536, 268435456, "MEMORY"  },
+    { "legacy",   "DELETE", "FULL",   -2000,  0,         "DEFAULT" },
 };
 
+profile_t* PROFILE;
+
+int BENCH_TRADES;
+
 //
 // Logging Utils
 //
 
-void vlog_ns(
-    const char* ns,
-    const char* fmt,
-    va_list vargs
-) {
-    printf("[%s]: ", ns);
-    vprintf(fmt, vargs);
-    putchar('\n');
+// records are formatted on the calling thread into its own ring, the log
+// thread drains every ring and does the actual writing. a full ring drops
+// the record rather than stall the reactor, the drops are reported later
+log_ring_t* log_ring() {
+    if (LOG_RING != NULL) {
+        return LOG_RING;
+    }
+
+    LOG_RING = (log_ring_t*)calloc(1, sizeof(log_ring_t));
+
+    fatal_assert(LOG_RING != NULL, "Out Of Memory");
+
+    LOG_RING->next = atomic_load(&LOG_RINGS);
+
+    while (!atomic_compare_exchange_weak(&LOG_RINGS, &LOG_RING->next, LOG_RING));
+
+    return LOG_RING;
 }
 
-void log_ns(
+// ns must outlive the record, every caller passes a literal
+void vlog_write(
+    int level,
     const char* ns,
+    const sockaddr_in* addr,
     const char* fmt,
-    ...
+    va_list vargs
 ) {
-    va_list vargs;
-    va_start(vargs, fmt);
-    vlog_ns(ns, fmt, vargs);
-    va_end(vargs);
-}
-
-#define log_inet(_addr, _fmt, ...) log_ns(inet_ntoa((_addr).sin_addr), (_fmt) __VA_OPT__(,) __VA_ARGS__)
+    if (level < LOG_LEVEL) {
+        return;
+    }
 
-//
-// Database Interactions
-//
+    if (!atomic_load_explicit(&LOG_ACTIVE, memory_order_acquire)) {
+        char addr_text[INET_ADDRSTRLEN];
 
-void db_add_user(
-    const char* first_name,
-    const char* last_name,
-    const char* user_name,
-    const char* password,
-    double balance
-) {
-    sqlite3_stmt* statement;
+        if (addr != NULL) {
+            ns = inet_ntop(AF_INET, &addr->sin_addr, addr_text, sizeof(addr_text));
+        }
 
-    int ret = sqlite3_prepare_v2(DATABASE, USERS_INSERT_QUERY, -1, &statement, NULL);
+        printf("[%s]: ", ns);
+        vprintf(fmt, vargs);
+        putchar('\n');
+        return;
+    }
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare User Insertion");
+    log_ring_t* ring = log_ring();
 
-    sqlite3_bind_text(statement, 1, first_name, -1, NULL);
-    sqlite3_bind_text(statement, 2, last_name, -1, NULL);
-    sqlite3_bind_text(statement, 3, user_name, -1, NULL);
-    sqlite3_bind_text(statement, 4, password, -1, NULL);
-    sqlite3_bind_double(statement, 5, balance);
+    // below warnings only every LOG_SAMPLE'th record per thread is kept
+    if (level < LOG_WARN && ring->sample++ % (unsigned)LOG_SAMPLE != 0) {
+        return;
+    }
 
-    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run User Insertion Query");
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize User Insertion Query");
-}
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
 
-double db_get_balance(
-    int user_id
-) {
-    sqlite3_stmt* statement;
+    if (tail - head == LOG_RING_SLOTS) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+        return;
+    }
 
-    int ret = sqlite3_prepare_v2(DATABASE, USERS_BALANCE_QUERY, -1, &statement, NULL);
+    log_record_t* record = &ring->records[tail % LOG_RING_SLOTS];
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare User Balance Query");
+    record->ns = ns;
 
-    sqlite3_bind_int(statement, 1, user_id);
+    if (addr != NULL) {
+        record->ns = NULL;
+        record->addr = addr->sin_addr;
+    }
 
-    ret = sqlite3_step(statement);
+    int len = vsnprintf(record->text, sizeof(record->text), fmt, vargs);
+    record->len = MIN(MAX(len, 0), (int)sizeof(record->text) - 1);
 
-    double balance = sqlite3_column_double(statement, 0);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize User Balance Query");
+    // the log thread sleeps once every ring is empty, so the record that ends
+    // that wakes it. paired with the fence in log_drain, either the drain
+    // sees this record or this sees the drain
+    atomic_thread_fence(memory_order_seq_cst);
 
-    return balance;
+    if (atomic_load_explicit(&ring->head, memory_order_relaxed) == tail) {
+        uint64_t one = 1;
+        write(LOG_WAKE_FD, &one, sizeof(one));
+    }
 }
 
-void db_set_balance(
-    int user_id,
-    double balance
+void log_write(
+    int level,
+    const char* ns,
+    const sockaddr_in* addr,
+    const char* fmt,
+    ...
 ) {
-    sqlite3_stmt* statement;
+    va_list vargs;
+    va_start(vargs, fmt);
+    vlog_write(level, ns, addr, fmt, vargs);
+    va_end(vargs);
+}
 
-    int ret = sqlite3_prepare_v2(DATABASE, USERS_UPDATE_BALANCE_QUERY, -1, &statement, NULL);
+// writes out whatever the rings hold, returns how many records that was
+size_t log_drain() {
+    size_t drained = 0;
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Balance Update Query");
+    for (log_ring_t* ring = atomic_load(&LOG_RINGS); ring != NULL; ring = ring->next) {
+        unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
 
-    sqlite3_bind_double(statement, 1, balance);
-    sqlite3_bind_int(statement, 2, user_id);
+        for (; head != tail; head++) {
+            log_record_t* record = &ring->records[head % LOG_RING_SLOTS];
 
-    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Balance Update Query");
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Balance Update Query");
-}
+            const char* ns = record->ns;
+            char addr_text[INET_ADDRSTRLEN];
 
-int db_user_count() {
-    sqlite3_stmt* statement;
+            if (ns == NULL) {
+                ns = inet_ntop(AF_INET, &record->addr, addr_text, sizeof(addr_text));
+            }
 
-    int ret = sqlite3_prepare_v2(DATABASE, USERS_COUNT_QUERY, -1, &statement, NULL);
+            fprintf(stdout, "[%s]: %.*s\n", ns, (int)record->len, record->text);
+            drained++;
+        }
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare User Count Query");
+        atomic_store_explicit(&ring->head, head, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst);
 
-    ret = sqlite3_step(statement);
+        unsigned dropped = atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
 
-    int count = sqlite3_column_int(statement, 0);
+        if (dropped != 0) {
+            fprintf(stdout, "[Log]: %u Records Dropped\n", dropped);
+            drained++;
+        }
+    }
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize User Count Query");
+    if (drained != 0) {
+        fflush(stdout);
+    }
 
-    return count;
+    return drained;
 }
 
-bool db_has_stock(
-    int user_id,
-    const char* symbol
+void* log_thread(
+    void* arg
 ) {
-    sqlite3_stmt* statement;
-
-    int ret = sqlite3_prepare_v2(DATABASE, STOCKS_COUNT_QUERY, -1, &statement, NULL);
-
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Stock Count Query");
-    
-    sqlite3_bind_int(statement, 1, user_id);
-    sqlite3_bind_text(statement, 2, symbol, -1, NULL);
-
-    ret = sqlite3_step(statement);
+    while (true) {
+        // anything logged before the stop was seen gets drained below
+        bool stop = atomic_load(&LOG_STOP);
 
-    int count = sqlite3_column_int(statement, 0);
+        if (log_drain() == 0) {
+            if (stop) {
+                break;
+            }
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Stock Count Query");
+            uint64_t count;
+            read(LOG_WAKE_FD, &count, sizeof(count));
+        }
+    }
 
-    return !!count;
+    return NULL;
 }
 
-void db_add_stock(
-    int user_id,
-    const char* symbol,
-    double balance
-) {
-    sqlite3_stmt* statement;
-
-    int ret = sqlite3_prepare_v2(DATABASE, STOCKS_INSERT_QUERY, -1, &statement, NULL);
+void log_start() {
+    fflush(stdout);
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Stock Insert Query");
+    if ((LOG_WAKE_FD = eventfd(0, 0)) < 0) {
+        fatal_error("Failed To Create Log Wake Event");
+    }
 
-    sqlite3_bind_text(statement, 1, symbol, -1, NULL);
-    sqlite3_bind_double(statement, 2, balance);
-    sqlite3_bind_int(statement, 3, user_id);
+    if (pthread_create(&LOG_THREAD, NULL, log_thread, NULL) != 0) {
+        fatal_error("Failed To Start Log Thread");
+    }
 
-    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Stock Insert Query");
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Stock Insert Query");
+    atomic_store_explicit(&LOG_ACTIVE, true, memory_order_release);
 }
 
-double db_get_stock_balance(
-    int user_id,
-    const char* symbol
-) {
-    sqlite3_stmt* statement;
-
-    int ret = sqlite3_prepare_v2(DATABASE, STOCKS_BALANCE_QUERY, -1, &statement, NULL);
+// drains every ring, later records are printed straight away again
+void log_stop() {
+    atomic_store(&LOG_ACTIVE, false);
+    atomic_store(&LOG_STOP, true);
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Stock Balance Query");
+    uint64_t one = 1;
+    write(LOG_WAKE_FD, &one, sizeof(one));
 
-    sqlite3_bind_int(statement, 1, user_id);
-    sqlite3_bind_text(statement, 2, symbol, -1, NULL);
+    pthread_join(LOG_THREAD, NULL);
+    close(LOG_WAKE_FD);
 
-    ret = sqlite3_step(statement);
+    LOG_WAKE_FD = -1;
 
-    double balance = sqlite3_column_double(statement, 0);
+    log_ring_t* ring = atomic_exchange(&LOG_RINGS, NULL);
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Stock Balance Query");
+    while (ring != NULL) {
+        log_ring_t* next = ring->next;
+        free(ring);
+        ring = next;
+    }
 
-    return balance;
+    LOG_RING = NULL;
 }
 
-void db_set_stock_balance(
-    int user_id,
-    const char* symbol,
-    double balance
-) {
-    sqlite3_stmt* statement;
+#define log_ns_at(_level, _ns, _fmt, ...) log_write((_level), (_ns), NULL, (_fmt) __VA_OPT__(,) __VA_ARGS__)
+#define log_inet_at(_level, _addr, _fmt, ...) log_write((_level), NULL, &(_addr), (_fmt) __VA_OPT__(,) __VA_ARGS__)
+#define log_ns(_ns, _fmt, ...) log_ns_at(LOG_INFO, (_ns), (_fmt) __VA_OPT__(,) __VA_ARGS__)
+#define log_inet(_addr, _fmt, ...) log_inet_at(LOG_INFO, (_addr), (_fmt) __VA_OPT__(,) __VA_ARGS__)
 
-    int ret = sqlite3_prepare_v2(DATABASE, STOCKS_UPDATE_BALANCE_QUERY, -1, &statement, NULL);
+//
+// Database Interactions
+//
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Stock Update Balance Query");
+void db_pragma(
+    const char* fmt,
+    ...
+) {
+    va_list vargs;
+    va_start(vargs, fmt);
+    char* query = vformat(fmt, vargs);
+    va_end(vargs);
 
-    sqlite3_bind_double(statement, 1, balance);
-    sqlite3_bind_int(statement, 2, user_id);
-    sqlite3_bind_text(statement, 3, symbol, -1, NULL);
+    char* error_msg = NULL;
 
-    ret = sqlite3_step(statement);
+    if (sqlite3_exec(DATABASE, query, NULL, 0, &error_msg) != SQLITE_OK) {
+        log_ns_at(LOG_WARN, "Init", "Failed To Run %s: %s", query, error_msg);
+        sqlite3_free(error_msg);
+        fatal_error("Failed To Configure Database");
+    }
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Stock Update Balance Query");
+    free(query);
 }
 
-int db_list_stock(
-    int user_id, 
-    char** tickers, 
-    double* balances, 
-    int count
+// the first column of the first row of a one-off query
+int db_scalar(
+    const char* query
 ) {
     sqlite3_stmt* statement;
 
-    int ret = sqlite3_prepare_v2(DATABASE, STOCKS_LIST_QUERY, -1, &statement, NULL);
-    int read_count = 0;
+    fatal_assert(sqlite3_prepare_v2(DATABASE, query, -1, &statement, NULL) == SQLITE_OK, 
+        "Failed To Prepare Query");
 
-    fatal_assert(ret == SQLITE_OK, "Failed To Prepare Stock List Query");
+    sqlite3_step(statement);
 
-    sqlite3_bind_int(statement, 1, user_id);
+    int value = sqlite3_column_int(statement, 0);
 
-    while (sqlite3_step(statement) == SQLITE_ROW) {
+    sqlite3_finalize(statement);
 
-        if (tickers != NULL && read_count < count) {
-            const char* col_ticker = (const char*)sqlite3_column_text(statement, 0);
-            fatal_assert(col_ticker != NULL, "Out Of Memory");
-            tickers[read_count] = calloc(strlen(col_ticker) + 1, sizeof(char));
-            strcpy(tickers[read_count], col_ticker);
-        }
+    return value;
+}
 
-        if (balances != NULL && read_count < count) {
-            balances[read_count] = sqlite3_column_double(statement, 1);
-        }
+// runs `query` and records `version` in one transaction, so a failure leaves
+// the database at the last version that applied cleanly
+void db_upgrade(
+    const char* query,
+    int version
+) {
+    char* script = format("BEGIN IMMEDIATE; %s PRAGMA user_version = %d; COMMIT;", query, version);
+    char* error_msg = NULL;
 
-        read_count++;
+    if (sqlite3_exec(DATABASE, script, NULL, 0, &error_msg) != SQLITE_OK) {
+        log_ns_at(LOG_WARN, "Init", "Migration Failed: %s", error_msg);
+        sqlite3_free(error_msg);
+        sqlite3_exec(DATABASE, "ROLLBACK", NULL, 0, NULL);
+        fatal_error("Failed To Migrate Schema");
     }
 
-    fatal_assert(sqlite3_finalize(statement) == SQLITE_OK, "Failed To Finalize Stock List Query");
-
-    return read_count;
+    free(script);
 }
 
-//
-//  Commands
-//
-
-void buy_command(
-    client_t* pclient, 
-    const char* args
-) { 
-    char ticker[1024];
-    double amount;
-    double price;
-    int id;
-    
-    if (args == NULL) {
-        client_send(pclient, CODE_403);
-        return;
-    }
-
-    int arg_count = sscanf(args, "%s %lf %lf %d", ticker, &amount, &price, &id);
-    
-    if (arg_count != 4 || amount <= 0.0 || price <= 0.0) {
-        client_send(pclient, CODE_403);
+// a new database starts at the current schema, an older one is brought up to
+// it one migration at a time
+void db_migrate() {
+    if (db_scalar(SCHEMA_EMPTY_QUERY) == 0) {
+        log_ns("Init", "Creating Schema Version %d", (int)LENGTHOF(MIGRATIONS));
+        db_upgrade(USERS_CREATE_QUERY STOCKS_CREATE_QUERY STOCKS_UNIQUE_QUERY, LENGTHOF(MIGRATIONS));
         return;
     }
 
-    int user_count = db_user_count();
-
-    if (id <= 0 || id > user_count) {
-        client_send(pclient, CODE_401);
-        return;
-    }
-    
-    double cost = amount * price;
-    double balance = db_get_balance(id);
+    int version = db_scalar(VERSION_QUERY);
 
-    if (cost > balance) {
-        client_send(pclient, CODE_402);
-        return;
+    if (version > (int)LENGTHOF(MIGRATIONS)) {
+        log_ns("Init", "Schema Version %d Is Newer Than This Server (%d)", version, (int)LENGTHOF(MIGRATIONS));
+        fatal_error("Unknown Schema Version");
     }
 
-    db_set_balance(id, balance - cost);
-
-    if (!db_has_stock(id, ticker)) {
-        db_add_stock(id, ticker, amount);
-    } else {
-        double stock_balance = db_get_stock_balance(id, ticker);
-        db_set_stock_balance(id, ticker, stock_balance + amount);
+    for (int i = version; i != (int)LENGTHOF(MIGRATIONS); i++) {
+        log_ns("Init", "Migrating Schema To Version %d: %s", i + 1, MIGRATIONS[i].name);
+        db_upgrade(MIGRATIONS[i].query, i + 1);
     }
-
-    client_send(pclient, CODE_200);
-    return;
 }
 
-void sell_command(
-    client_t* pclient, 
-    const char* args
+// opens the database under `profile`, makes sure the schema exists and
+// prepares every statement against it
+void db_open(
+    const char* path,
+    const profile_t* profile
 ) {
-    char ticker[1024];
-    double amount;
-    double price;
-    int id;
+    sqlite3_open(path, &DATABASE);
 
-    if (args == NULL) {
-        client_send(pclient, CODE_403);
-        return;
+    if (DATABASE == NULL) {
+        fatal_error("Failed To Open SQLite Database");
     }
 
-    int arg_count = sscanf(args, "%s %lf %lf %d", ticker, &price, &amount, &id);
+    // WAL lets readers carry on while a trade holds the write lock, and
+    // commits append to one file instead of syncing a journal and the database
 
-    if (arg_count != 4 || amount <= 0.0 || price <= 0.0) {
-        client_send(pclient, CODE_403);
-        return;
-    }
+    db_pragma("PRAGMA journal_mode = %s", profile->journal_mode);
+    db_pragma("PRAGMA synchronous = %s", profile->synchronous);
+    db_pragma("PRAGMA cache_size = %d", profile->cache_size);
+    db_pragma("PRAGMA mmap_size = %lld", (long long)profile->mmap_size);
+    db_pragma("PRAGMA temp_store = %s", profile->temp_store);
 
-    int user_count = db_user_count();
+    // other processes may hold the write lock briefly, wait rather than fail
 
-    if (id <= 0 || id > user_count) {
-        client_send(pclient, CODE_401);
-        return;
-    }
+    sqlite3_busy_timeout(DATABASE, 5000);
 
-    if (!db_has_stock(id, ticker)) {
-        client_send(pclient, CODE_404);
-        return;
-    }
+    // statements are checked against the schema as they are prepared, the
+    // holdings upsert needs the unique index in place first
 
-    double balance = db_get_stock_balance(id, ticker);
+    db_migrate();
 
-    if (balance < amount) {
-        client_send(pclient, CODE_404);
-        return;
-    }
+    for (size_t i = 0; i != LENGTHOF(STATEMENTS); i++) {
+        int ret = sqlite3_prepare_v3(DATABASE, STATEMENTS[i].query, -1, 
+            SQLITE_PREPARE_PERSISTENT, STATEMENTS[i].pstatement, NULL);
 
-    db_set_stock_balance(id, ticker, balance - amount);
+        fatal_assert(ret == SQLITE_OK, "Failed To Prepare Query");
+    }
 
-    double cost = amount * price;
+    if (!db_has_users()) {
+        db_add_user("Nathan", "Morris", "nmorrisk", "password", 1000 * (fixed_t)FIXED_SCALE);
+        db_add_user("Jeffery", "Epstein", "FinanceKing16", "ilovekids", 10000000 * (fixed_t)FIXED_SCALE);
+        db_add_user("Robert", "Kelley", "RKelly", "goldenshowers", 100000 * (fixed_t)FIXED_SCALE);
+    }
+}
 
-    db_set_balance(id, db_get_balance(id) + cost);
+void db_close() {
+    for (size_t i = 0; i != LENGTHOF(STATEMENTS); i++) {
+        sqlite3_finalize(*STATEMENTS[i].pstatement);
+    }
 
-    client_send(pclient, CODE_200);
+    sqlite3_close(DATABASE);
 }
 
-void list_command(
-    client_t* pclient, 
-    const char* args
-) { 
-    int id = 1;
+void db_add_user(
+    const char* first_name,
+    const char* last_name,
+    const char* user_name,
+    const char* password,
+    fixed_t balance
+) {
+    sqlite3_stmt* statement = USERS_INSERT_STMT;
 
-    if (args != NULL) {
-        int arg_count = sscanf(args, "%d", &id);
+    sqlite3_bind_text(statement, 1, first_name, -1, NULL);
+    sqlite3_bind_text(statement, 2, last_name, -1, NULL);
+    sqlite3_bind_text(statement, 3, user_name, -1, NULL);
+    sqlite3_bind_text(statement, 4, password, -1, NULL);
+    sqlite3_bind_int64(statement, 5, balance);
 
-        if (arg_count != 1) {
-            client_send(pclient, CODE_403);
-            return;
-        }
-    }
+    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run User Insertion Query");
+    sqlite3_reset(statement);
 
-    if (id <= 0 || id > db_user_count()) {
-        client_send(pclient, CODE_401);
-        return;
-    }
+    store_add_user((int)sqlite3_last_insert_rowid(DATABASE), balance);
+}
 
-    char** tickers;
-    double* balances;
+// fails, changing nothing, if the balance would go negative
+bool db_debit_balance(
+    int user_id,
+    fixed_t amount
+) {
+    sqlite3_stmt* statement = USERS_DEBIT_BALANCE_STMT;
 
-    int count = db_list_stock(id, NULL, NULL, 0);
+    sqlite3_bind_int64(statement, 1, amount);
+    sqlite3_bind_int(statement, 2, user_id);
 
-    if (count == 0) {
-        client_send(pclient, "%s\nNo Stocks Owned", CODE_200);
-        return;
-    }
+    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Balance Debit Query");
+    sqlite3_reset(statement);
 
-    tickers = (char**)calloc(count, sizeof(char*));
+    return sqlite3_changes(DATABASE) == 1;
+}
 
-    fatal_assert(tickers != NULL, "Out Of Memory");
+void db_credit_balance(
+    int user_id,
+    fixed_t amount
+) {
+    sqlite3_stmt* statement = USERS_CREDIT_BALANCE_STMT;
 
-    balances = (double*)calloc(count, sizeof(double));
+    sqlite3_bind_int64(statement, 1, amount);
+    sqlite3_bind_int(statement, 2, user_id);
 
-    fatal_assert(balances != NULL, "Out Of Memory");
+    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Balance Credit Query");
+    sqlite3_reset(statement);
+}
 
-    count = db_list_stock(id, tickers, balances, count);
+// stops at the first row, the table is never scanned
+bool db_has_users() {
+    sqlite3_stmt* statement = USERS_EMPTY_STMT;
 
-    // could-a, should-a, would-a used C++
-    char list_buffer[1024];
+    sqlite3_step(statement);
 
-    memcpy(list_buffer, CODE_200, strlen(CODE_200));
+    bool has_users = sqlite3_column_int(statement, 0) != 0;
 
-    char* pfront = list_buffer + strlen(CODE_200);
+    sqlite3_reset(statement);
 
-    *(pfront++) = '\n';
+    return has_users;
+}
 
-    char* pend = &list_buffer[1024];
+// fails, changing nothing, if the user holds less than `amount` of the stock
+bool db_debit_stock(
+    int user_id,
+    const char* symbol,
+    fixed_t amount
+) {
+    sqlite3_stmt* statement = STOCKS_DEBIT_STMT;
 
-    for (int i = 0; i != count && pfront < pend; i++) {
-        int written = snprintf(pfront, (pend - pfront) + 1, "%c%s : %.2lf", i ? ' ' : '\n', tickers[i], balances[i]);
+    sqlite3_bind_int64(statement, 1, amount);
+    sqlite3_bind_int(statement, 2, user_id);
+    sqlite3_bind_text(statement, 3, symbol, -1, NULL);
 
-        if (written < 0) {
-            break;
-        }
+    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Stock Debit Query");
+    sqlite3_reset(statement);
 
-        pfront += written;
-    }
+    return sqlite3_changes(DATABASE) == 1;
+}
 
-    for (int i = 0; i != count; i++) {
-        free(tickers[i]);
-    }
+// inserts the holding or adds to it, relies on the unique (user_id, stock_symbol) index
+void db_credit_stock(
+    int user_id,
+    const char* symbol,
+    fixed_t amount
+) {
+    sqlite3_stmt* statement = STOCKS_CREDIT_STMT;
 
-    free(tickers);
-    free(balances);
+    sqlite3_bind_text(statement, 1, symbol, -1, NULL);
+    sqlite3_bind_int64(statement, 2, amount);
+    sqlite3_bind_int(statement, 3, user_id);
 
-    client_send(pclient, list_buffer);
+    fatal_assert(sqlite3_step(statement) == SQLITE_DONE, "Failed To Run Stock Credit Query");
+    sqlite3_reset(statement);
 }
 
-void balance_command(
-    client_t* pclient, 
-    const char* args
-) { 
-    int id = 1;
+void db_begin() {
+    fatal_assert(sqlite3_step(BEGIN_STMT) == SQLITE_DONE, "Failed To Begin Transaction");
+    sqlite3_reset(BEGIN_STMT);
+}
 
-    if (args != NULL) {
-        int arg_count = sscanf(args, "%d", &id);
+void db_commit() {
+    fatal_assert(sqlite3_step(COMMIT_STMT) == SQLITE_DONE, "Failed To Commit Transaction");
+    sqlite3_reset(COMMIT_STMT);
+}
 
-        if (arg_count != 1) {
-            client_send(pclient, CODE_403);
-            return;
-        }
-    }
+//
+// Account Store
+//
 
-    if (id <= 0 || id > db_user_count()) {
-        client_send(pclient, CODE_401);
-        return;
+// NULL for users that do not exist
+account_t* store_account(
+    int user_id
+) {
+    if (user_id <= 0 || user_id > ACCOUNT_COUNT || !ACCOUNTS[user_id - 1].exists) {
+        return NULL;
     }
 
-    client_send(pclient, "%s\nBalance = %.2lf", CODE_200, db_get_balance(id));
+    return &ACCOUNTS[user_id - 1];
 }
 
-void shutdown_command(
-    client_t* pclient, 
-    const char* args
+// locks the user's lane for the rest of a command, unless there is no such user
+account_t* store_enter(
+    int user_id
+) {
+    account_t* account = store_account(user_id);
+
+    if (account == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&LANES[user_id % LANE_COUNT].lock);
+
+    return account;
+}
+
+// notes how far the journal has to get before a reply that saw the account
+// may go out, see client_handle
+void store_leave(
+    int user_id
+) {
+    STORE_EPOCH = MAX(STORE_EPOCH, ACCOUNTS[user_id - 1].epoch);
+
+    pthread_mutex_unlock(&LANES[user_id % LANE_COUNT].lock);
+}
+
+// takes one trade on an account whose lane the caller holds, leaving its
+// journal entry in *pentry. returns a STATUS_ code, the account is only
+// touched with STATUS_OK
+int store_trade(
+    account_t* account,
+    int user_id,
+    bool sell,
+    const char* symbol,
+    fixed_t amount,
+    fixed_t price,
+    journal_entry_t** pentry
+) {
+    holding_t* holding;
+    fixed_t cost;
+
+    if (sell) {
+        holding = store_holding(account, symbol, false);
+
+        if (holding == NULL || holding->balance < amount) {
+            return STATUS_NO_STOCK;
+        }
+
+        // a seller does not get the fraction of a micro-dollar, see below
+        if (!fixed_mul(amount, price, false, &cost) || account->balance > INT64_MAX - cost) {
+            return STATUS_FORMAT_ERROR;
+        }
+
+        holding->balance -= amount;
+        account->balance += cost;
+    } else {
+        // a buyer pays for the fraction of a micro-dollar
+        if (!fixed_mul(amount, price, true, &cost) || account->balance < cost) {
+            return STATUS_NO_BALANCE;
+        }
+
+        // checked before the holding is opened, a refusal leaves no empty one behind
+        holding = store_holding(account, symbol, false);
+
+        if (holding != NULL && holding->balance > INT64_MAX - amount) {
+            return STATUS_FORMAT_ERROR;
+        }
+
+        if (holding == NULL) {
+            holding = store_holding(account, symbol, true);
+        }
+
+        account->balance -= cost;
+        holding->balance += amount;
+    }
+
+    *pentry = journal_entry(sell, user_id, symbol, amount, cost);
+
+    return STATUS_OK;
+}
+
+// gives back a trade store_trade took, without leaving the lane in between
+void store_untrade(
+    account_t* account,
+    const journal_entry_t* entry
+) {
+    holding_t* holding = store_holding(account, entry->symbol, false);
+
+    if (entry->sell) {
+        holding->balance += entry->amount;
+        account->balance -= entry->cost;
+    } else {
+        holding->balance -= entry->amount;
+        account->balance += entry->cost;
+    }
+}
+
+// the store takes the trade, the journal writes it through later and the
+// reply waits for that, see client_handle. returns a STATUS_ code
+int store_take(
+    int user_id,
+    bool sell,
+    const char* symbol,
+    fixed_t amount,
+    fixed_t price
+) {
+    if (amount <= 0 || price <= 0) {
+        return STATUS_FORMAT_ERROR;
+    }
+
+    account_t* account = store_enter(user_id);
+
+    if (account == NULL) {
+        return STATUS_NO_USER;
+    }
+
+    journal_entry_t* entry;
+    int status = store_trade(account, user_id, sell, symbol, amount, price, &entry);
+
+    if (status == STATUS_OK) {
+        journal_append(entry);
+    }
+
+    store_leave(user_id);
+
+    return status;
+}
+
+// finds the account's holding of `symbol`, adding an empty one if `create` is set
+holding_t* store_holding(
+    account_t* account,
+    const char* symbol,
+    bool create
+) {
+    for (int i = 0; i != account->holding_count; i++) {
+        if (strcmp(account->holdings[i].symbol, symbol) == 0) {
+            return &account->holdings[i];
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (account->holding_count == account->holding_cap) {
+        account->holding_cap = MAX(4, account->holding_cap * 2);
+        account->holdings = (holding_t*)realloc(account->holdings, 
+            account->holding_cap * sizeof(holding_t));
+
+        fatal_assert(account->holdings != NULL, "Out Of Memory");
+    }
+
+    holding_t* holding = &account->holdings[account->holding_count++];
+
+    holding->symbol = strdup(symbol);
+    holding->balance = 0.0;
+
+    fatal_assert(holding->symbol != NULL, "Out Of Memory");
+
+    return holding;
+}
+
+// the account table doubles as the user index, checking an id is one lookup.
+// db_add_user keeps it in step with Users
+void store_add_user(
+    int user_id,
+    fixed_t balance
+) {
+    if (user_id <= 0) {
+        return;
+    }
+
+    if (user_id > ACCOUNT_COUNT) {
+        int count = MAX(user_id, ACCOUNT_COUNT * 2);
+
+        ACCOUNTS = (account_t*)realloc(ACCOUNTS, count * sizeof(account_t));
+
+        fatal_assert(ACCOUNTS != NULL, "Out Of Memory");
+
+        memset(&ACCOUNTS[ACCOUNT_COUNT], 0, (count - ACCOUNT_COUNT) * sizeof(account_t));
+        ACCOUNT_COUNT = count;
+    }
+
+    ACCOUNTS[user_id - 1].exists = true;
+    ACCOUNTS[user_id - 1].balance = balance;
+}
+
+void store_load() {
+    // one lane per core, the accounts themselves never move once loaded
+
+    LANE_COUNT = MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+    // calloc only promises alignment for the basic types, not for the padding
+    LANES = (lane_t*)aligned_alloc(sizeof(lane_t), LANE_COUNT * sizeof(lane_t));
+
+    fatal_assert(LANES != NULL, "Out Of Memory");
+
+    for (int i = 0; i != LANE_COUNT; i++) {
+        pthread_mutex_init(&LANES[i].lock, NULL);
+    }
+
+    sqlite3_stmt* statement = USERS_LOAD_STMT;
+
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        store_add_user(sqlite3_column_int(statement, 0), sqlite3_column_int64(statement, 1));
+    }
+
+    sqlite3_reset(statement);
+
+    statement = STOCKS_LOAD_STMT;
+
+    while (sqlite3_step(statement) == SQLITE_ROW) {
+        account_t* account = store_account(sqlite3_column_int(statement, 0));
+        const char* symbol = (const char*)sqlite3_column_text(statement, 1);
+
+        // holdings of users that are gone can never be traded or listed
+        if (account == NULL || symbol == NULL) {
+            continue;
+        }
+
+        store_holding(account, symbol, true)->balance += sqlite3_column_int64(statement, 2);
+    }
+
+    sqlite3_reset(statement);
+}
+
+void store_free() {
+    for (int i = 0; i != ACCOUNT_COUNT; i++) {
+        for (int j = 0; j != ACCOUNTS[i].holding_count; j++) {
+            free(ACCOUNTS[i].holdings[j].symbol);
+        }
+
+        free(ACCOUNTS[i].holdings);
+    }
+
+    free(ACCOUNTS);
+
+    ACCOUNTS = NULL;
+    ACCOUNT_COUNT = 0;
+
+    for (int i = 0; i != LANE_COUNT; i++) {
+        pthread_mutex_destroy(&LANES[i].lock);
+    }
+
+    free(LANES);
+
+    LANES = NULL;
+    LANE_COUNT = 0;
+}
+
+journal_entry_t* journal_entry(
+    bool sell,
+    int user_id,
+    const char* symbol,
+    fixed_t amount,
+    fixed_t cost
+) {
+    size_t symbol_len = strlen(symbol) + 1;
+    journal_entry_t* entry = (journal_entry_t*)malloc(sizeof(journal_entry_t) + symbol_len);
+
+    fatal_assert(entry != NULL, "Out Of Memory");
+
+    entry->next = NULL;
+    entry->sell = sell;
+    entry->user_id = user_id;
+    entry->amount = amount;
+    entry->cost = cost;
+    memcpy(entry->symbol, symbol, symbol_len);
+
+    return entry;
+}
+
+// queues a trade the store has already taken, or a chain of them which then
+// share a transaction. the caller is still in the user's lane so a user's
+// trades reach the journal in the order they were taken
+void journal_append(
+    journal_entry_t* entry
+) {
+    journal_entry_t** tail = &entry->next;
+
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
+    }
+
+    pthread_mutex_lock(&DATABASE_LOCK);
+
+    *JOURNAL_TAIL = entry;
+    JOURNAL_TAIL = tail;
+    JOURNAL_LAST = JOURNAL_EPOCH;
+    ACCOUNTS[entry->user_id - 1].epoch = JOURNAL_EPOCH;
+
+    pthread_cond_signal(&JOURNAL_COND);
+    pthread_mutex_unlock(&DATABASE_LOCK);
+}
+
+// writes a batch of trades through in one transaction. the store checked
+// every one of them, so a refusal here means the two have drifted apart
+void journal_apply(
+    journal_entry_t* entries
+) {
+    db_begin();
+
+    for (journal_entry_t* entry = entries; entry != NULL; entry = entry->next) {
+        if (entry->sell) {
+            fatal_assert(db_debit_stock(entry->user_id, entry->symbol, entry->amount), 
+                "Journal Out Of Step With Database");
+            db_credit_balance(entry->user_id, entry->cost);
+        } else {
+            fatal_assert(db_debit_balance(entry->user_id, entry->cost), 
+                "Journal Out Of Step With Database");
+            db_credit_stock(entry->user_id, entry->symbol, entry->amount);
+        }
+    }
+
+    db_commit();
+}
+
+// the only thread touching SQLite once the store is loaded
+void* journal_thread(
+    void* arg
+) {
+    pthread_mutex_lock(&DATABASE_LOCK);
+
+    while (true) {
+        while (JOURNAL_HEAD == NULL && !JOURNAL_STOP) {
+            pthread_cond_wait(&JOURNAL_COND, &DATABASE_LOCK);
+        }
+
+        if (JOURNAL_HEAD == NULL) {
+            break;
+        }
+
+        // let more trades gather into the same transaction
+
+        if (JOURNAL_WINDOW_US > 0 && !JOURNAL_STOP) {
+            pthread_mutex_unlock(&DATABASE_LOCK);
+            usleep(JOURNAL_WINDOW_US);
+            pthread_mutex_lock(&DATABASE_LOCK);
+        }
+
+        journal_entry_t* entries = JOURNAL_HEAD;
+        uint64_t epoch = JOURNAL_EPOCH++;
+
+        JOURNAL_HEAD = NULL;
+        JOURNAL_TAIL = &JOURNAL_HEAD;
+
+        pthread_mutex_unlock(&DATABASE_LOCK);
+
+        journal_apply(entries);
+
+        while (entries != NULL) {
+            journal_entry_t* next = entries->next;
+            free(entries);
+            entries = next;
+        }
+
+        pthread_mutex_lock(&DATABASE_LOCK);
+
+        JOURNAL_DURABLE = epoch;
+        pthread_cond_broadcast(&JOURNAL_DURABLE_COND);
+
+        // replies held on the reactors can go now
+        reactor_wake_durable(epoch);
+    }
+
+    pthread_mutex_unlock(&DATABASE_LOCK);
+
+    return NULL;
+}
+
+void journal_start() {
+    if (pthread_create(&JOURNAL_THREAD, NULL, journal_thread, NULL) != 0) {
+        fatal_error("Failed To Start Journal Thread");
+    }
+}
+
+// blocks until every trade taken so far is durable
+void journal_wait() {
+    pthread_mutex_lock(&DATABASE_LOCK);
+
+    while (JOURNAL_DURABLE < JOURNAL_LAST) {
+        pthread_cond_wait(&JOURNAL_DURABLE_COND, &DATABASE_LOCK);
+    }
+
+    pthread_mutex_unlock(&DATABASE_LOCK);
+}
+
+// flushes what is left, then stops the flusher
+void journal_stop() {
+    pthread_mutex_lock(&DATABASE_LOCK);
+    JOURNAL_STOP = true;
+    pthread_cond_signal(&JOURNAL_COND);
+    pthread_mutex_unlock(&DATABASE_LOCK);
+
+    pthread_join(JOURNAL_THREAD, NULL);
+}
+//
+//  Commands
+//
+
+void buy_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    char ticker[1024];
+    char amount_text[64];
+    char price_text[64];
+    fixed_t amount;
+    fixed_t price;
+    int id;
+    
+    if (args == NULL) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    int arg_count = sscanf(args, "%1023s %63s %63s %d", ticker, amount_text, price_text, &id);
+    
+    if (arg_count != 4 || !fixed_parse(amount_text, &amount) || !fixed_parse(price_text, &price)) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    client_send_status(pclient, store_take(id, false, ticker, amount, price));
+}
+
+void sell_command(
+    client_t* pclient, 
+    const char* args
+) {
+    char ticker[1024];
+    char amount_text[64];
+    char price_text[64];
+    fixed_t amount;
+    fixed_t price;
+    int id;
+
+    if (args == NULL) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    int arg_count = sscanf(args, "%1023s %63s %63s %d", ticker, price_text, amount_text, &id);
+
+    if (arg_count != 4 || !fixed_parse(amount_text, &amount) || !fixed_parse(price_text, &price)) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    client_send_status(pclient, store_take(id, true, ticker, amount, price));
+}
+
+void list_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    int id = 1;
+
+    if (args != NULL) {
+        int arg_count = sscanf(args, "%d", &id);
+
+        if (arg_count != 1) {
+            client_send_code(pclient, CODE_403);
+            return;
+        }
+    }
+
+    account_t* account = store_enter(id);
+
+    if (account == NULL) {
+        client_send_code(pclient, CODE_401);
+        return;
+    }
+
+    if (account->holding_count == 0) {
+        client_send_code(pclient, CODE_200 "\nNo Stocks Owned");
+        store_leave(id);
+        return;
+    }
+
+    // one pass, each row lands in the output as it is formatted, however many there are
+
+    client_send_code(pclient, CODE_200 "\n");
+
+    for (int i = 0; i != account->holding_count; i++) {
+        client_queue(pclient, i ? " " : "\n", 1);
+        client_queue(pclient, account->holdings[i].symbol, strlen(account->holdings[i].symbol));
+        client_send_code(pclient, " : ");
+        client_send_fixed(pclient, account->holdings[i].balance);
+    }
+
+    store_leave(id);
+}
+
+void balance_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    int id = 1;
+
+    if (args != NULL) {
+        int arg_count = sscanf(args, "%d", &id);
+
+        if (arg_count != 1) {
+            client_send_code(pclient, CODE_403);
+            return;
+        }
+    }
+
+    account_t* account = store_enter(id);
+
+    if (account == NULL) {
+        client_send_code(pclient, CODE_401);
+        return;
+    }
+
+    client_send_code(pclient, CODE_200 "\nBalance = ");
+    client_send_fixed(pclient, account->balance);
+    store_leave(id);
+}
+
+void shutdown_command(
+    client_t* pclient, 
+    const char* args
 ) { 
     if (args != NULL) {
-        client_send(pclient, CODE_403);
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+    
+    client_send_code(pclient, CODE_200);
+    
+    RUNNING = false;
+
+    reactor_wake_all();
+}
+
+void quit_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    if (args != NULL) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }    
+
+    client_send_code(pclient, CODE_200);
+
+    client_remove(pclient);
+}
+
+// everything after the reply is frames, see shared.h
+void binary_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    if (args != NULL) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }    
+
+    client_send_code(pclient, CODE_200);
+
+    pclient->binary = true;
+}
+
+// one leg of a batch, checked and taken against the account as the legs
+// before it left it. a taken leg joins the front of *ptaken
+int batch_leg(
+    account_t* account,
+    int user_id,
+    const char* leg,
+    size_t leg_len,
+    journal_entry_t** ptaken
+) {
+    char text[256];
+    char verb[8];
+    char symbol[64];
+    char first_text[64];
+    char second_text[64];
+    fixed_t amount;
+    fixed_t price;
+
+    if (leg_len >= sizeof(text)) {
+        return STATUS_FORMAT_ERROR;
+    }
+
+    memcpy(text, leg, leg_len);
+    text[leg_len] = '\0';
+
+    if (sscanf(text, "%7s %63s %63s %63s", verb, symbol, first_text, second_text) != 4) {
+        return STATUS_FORMAT_ERROR;
+    }
+
+    bool sell = strcasecmp(verb, "sell") == 0;
+
+    if (!sell && strcasecmp(verb, "buy") != 0) {
+        return STATUS_INVALID_COMMAND;
+    }
+
+    // the same argument order as buy_command and sell_command
+    const char* amount_text = sell ? second_text : first_text;
+    const char* price_text = sell ? first_text : second_text;
+
+    if (!fixed_parse(amount_text, &amount) || !fixed_parse(price_text, &price) || amount <= 0 || price <= 0) {
+        return STATUS_FORMAT_ERROR;
+    }
+
+    journal_entry_t* entry;
+    int status = store_trade(account, user_id, sell, symbol, amount, price, &entry);
+
+    if (status == STATUS_OK) {
+        entry->next = *ptaken;
+        *ptaken = entry;
+    }
+
+    return status;
+}
+
+// "batch id leg; leg; ..." where a leg is a buy or sell without the id. every
+// leg is taken, all in one transaction, or none is. the reply carries the
+// first refusal, or 200, then a "leg status" line for each leg in order
+void batch_command(
+    client_t* pclient, 
+    const char* args
+) { 
+    int statuses[BATCH_MAX_LEGS];
+    int leg_count = 1;
+    int id;
+    int offset;
+
+    if (args == NULL || sscanf(args, "%d%n", &id, &offset) != 1) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    for (const char* c = args + offset; *c != '\0'; c++) {
+        leg_count += *c == ';';
+    }
+
+    if (leg_count > BATCH_MAX_LEGS) {
+        client_send_code(pclient, CODE_403);
+        return;
+    }
+
+    account_t* account = store_enter(id);
+
+    if (account == NULL) {
+        client_send_code(pclient, CODE_401);
+        return;
+    }
+
+    // legs go on checking after a refusal so the reply reports every one
+
+    int holding_count = account->holding_count;
+    journal_entry_t* taken = NULL;
+    int status = STATUS_OK;
+    const char* leg = args + offset;
+
+    for (int i = 0; i != leg_count; i++) {
+        size_t leg_len = strcspn(leg, ";");
+
+        statuses[i] = batch_leg(account, id, leg, leg_len, &taken);
+
+        if (status == STATUS_OK) {
+            status = statuses[i];
+        }
+
+        leg += leg_len + 1;
+    }
+
+    // taken is newest first, given back in that order, or turned around so
+    // the journal sees the legs as they were sent
+
+    journal_entry_t* ordered = NULL;
+
+    while (taken != NULL) {
+        journal_entry_t* next = taken->next;
+
+        if (status == STATUS_OK) {
+            taken->next = ordered;
+            ordered = taken;
+        } else {
+            store_untrade(account, taken);
+            free(taken);
+        }
+
+        taken = next;
+    }
+
+    if (ordered != NULL) {
+        journal_append(ordered);
+    }
+
+    // holdings a refused batch opened are empty again
+    while (status != STATUS_OK && account->holding_count > holding_count) {
+        free(account->holdings[--account->holding_count].symbol);
+    }
+
+    store_leave(id);
+
+    client_send_status(pclient, status);
+
+    for (int i = 0; i != leg_count; i++) {
+        client_send(pclient, "\n%d %d", i + 1, statuses[i]);
+    }
+}
+
+// FNV-1a over a verb that is already lower case
+uint32_t command_hash(
+    const char* verb,
+    size_t len,
+    uint32_t seed
+) {
+    uint32_t hash = 2166136261u ^ seed;
+
+    for (size_t i = 0; i != len; i++) {
+        hash = (hash ^ (uint8_t)verb[i]) * 16777619u;
+    }
+
+    return hash & (COMMAND_SLOTS - 1);
+}
+
+// tries seeds until every verb lands in a slot of its own, lookups then never probe
+void command_index() {
+    for (uint32_t seed = 0; seed != 1u << 16; seed++) {
+        memset(COMMAND_TABLE, 0, sizeof(COMMAND_TABLE));
+
+        size_t i = 0;
+
+        for (; i != LENGTHOF(COMMANDS); i++) {
+            command_t* command = &COMMANDS[i];
+
+            command->verb_len = strlen(command->verb);
+
+            fatal_assert(command->verb_len <= MAX_VERB_LEN, "Command Verb Too Long");
+
+            uint32_t slot = command_hash(command->verb, command->verb_len, seed);
+
+            if (COMMAND_TABLE[slot] != NULL) {
+                break;
+            }
+
+            COMMAND_TABLE[slot] = command;
+        }
+
+        if (i == LENGTHOF(COMMANDS)) {
+            COMMAND_SEED = seed;
+            return;
+        }
+    }
+
+    fatal_error("No Perfect Hash For Commands, Raise COMMAND_SLOTS");
+}
+
+// NULL unless `verb` is exactly one of COMMANDS, ignoring case
+command_t* command_find(
+    const char* verb,
+    size_t len
+) {
+    if (len == 0 || len > MAX_VERB_LEN) {
+        return NULL;
+    }
+
+    char folded[MAX_VERB_LEN];
+
+    for (size_t i = 0; i != len; i++) {
+        folded[i] = tolower((unsigned char)verb[i]);
+    }
+
+    command_t* command = COMMAND_TABLE[command_hash(folded, len, COMMAND_SEED)];
+
+    if (command == NULL || command->verb_len != len || memcmp(command->verb, folded, len) != 0) {
+        return NULL;
+    }
+
+    return command;
+}
+
+//
+//  Frame Commands
+//
+
+void frame_trade(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body,
+    bool sell
+) {
+    frame_trade_t trade;
+    char symbol[FRAME_SYMBOL_LEN + 1];
+
+    memcpy(&trade, body, sizeof(trade));
+    memcpy(symbol, trade.symbol, FRAME_SYMBOL_LEN);
+    symbol[FRAME_SYMBOL_LEN] = '\0';
+
+    if (symbol[0] == '\0') {
+        client_send_frame(pclient, request, STATUS_FORMAT_ERROR, NULL, 0);
+        return;
+    }
+
+    int user_id = (int32_t)le32toh(trade.user_id);
+    fixed_t amount = (int64_t)le64toh(trade.amount);
+    fixed_t price = (int64_t)le64toh(trade.price);
+
+    client_send_frame(pclient, request, store_take(user_id, sell, symbol, amount, price), NULL, 0);
+}
+
+void frame_buy(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    frame_trade(pclient, request, body, false);
+}
+
+void frame_sell(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    frame_trade(pclient, request, body, true);
+}
+
+void frame_list(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    frame_user_t user;
+    memcpy(&user, body, sizeof(user));
+
+    int user_id = (int32_t)le32toh(user.user_id);
+    account_t* account = store_enter(user_id);
+
+    if (account == NULL) {
+        client_send_frame(pclient, request, STATUS_NO_USER, NULL, 0);
+        return;
+    }
+
+    // sized up front so the whole reply is written in one piece
+
+    uint32_t len = 0;
+
+    for (int i = 0; i != account->holding_count; i++) {
+        len += sizeof(frame_holding_t) + strlen(account->holdings[i].symbol);
+    }
+
+    frame_header_t header = {
+        .length = htole32(len),
+        .opcode = htole16(request->opcode),
+        .status = htole16(STATUS_OK),
+        .request_id = htole32(request->request_id),
+    };
+
+    char* out = client_out_space(pclient, sizeof(header) + len);
+    char* iter = out + sizeof(header);
+
+    memcpy(out, &header, sizeof(header));
+
+    for (int i = 0; i != account->holding_count; i++) {
+        size_t symbol_len = strlen(account->holdings[i].symbol);
+
+        frame_holding_t holding = {
+            .balance = htole64(account->holdings[i].balance),
+            .symbol_len = htole16(symbol_len),
+        };
+
+        memcpy(iter, &holding, sizeof(holding));
+        memcpy(iter + sizeof(holding), account->holdings[i].symbol, symbol_len);
+        iter += sizeof(holding) + symbol_len;
+    }
+
+    client_out_commit(pclient, sizeof(header) + len);
+
+    store_leave(user_id);
+}
+
+void frame_balance(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    frame_user_t user;
+    memcpy(&user, body, sizeof(user));
+
+    int user_id = (int32_t)le32toh(user.user_id);
+    account_t* account = store_enter(user_id);
+
+    if (account == NULL) {
+        client_send_frame(pclient, request, STATUS_NO_USER, NULL, 0);
+        return;
+    }
+
+    frame_balance_t balance = { .balance = htole64(account->balance) };
+
+    store_leave(user_id);
+
+    client_send_frame(pclient, request, STATUS_OK, &balance, sizeof(balance));
+}
+
+void frame_shutdown(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    client_send_frame(pclient, request, STATUS_OK, NULL, 0);
+
+    RUNNING = false;
+
+    reactor_wake_all();
+}
+
+void frame_quit(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    client_send_frame(pclient, request, STATUS_OK, NULL, 0);
+
+    client_remove(pclient);
+}
+
+//
+// Timers
+//
+
+uint64_t monotonic_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+void timer_place(
+    event_timer_t* ptimer,
+    int slot
+) {
+    TIMERS[slot] = ptimer;
+    ptimer->slot = slot;
+}
+
+void timer_sift_up(
+    int slot
+) {
+    event_timer_t* ptimer = TIMERS[slot];
+
+    while (slot != 0) {
+        int parent = (slot - 1) / 2;
+
+        if (TIMERS[parent]->deadline_us <= ptimer->deadline_us) {
+            break;
+        }
+
+        timer_place(TIMERS[parent], slot);
+        slot = parent;
+    }
+
+    timer_place(ptimer, slot);
+}
+
+void timer_sift_down(
+    int slot
+) {
+    event_timer_t* ptimer = TIMERS[slot];
+
+    while (true) {
+        int child = slot * 2 + 1;
+
+        if (child >= TIMER_COUNT) {
+            break;
+        }
+
+        if (child + 1 < TIMER_COUNT && TIMERS[child + 1]->deadline_us < TIMERS[child]->deadline_us) {
+            child++;
+        }
+
+        if (ptimer->deadline_us <= TIMERS[child]->deadline_us) {
+            break;
+        }
+
+        timer_place(TIMERS[child], slot);
+        slot = child;
+    }
+
+    timer_place(ptimer, slot);
+}
+
+// (re)schedules the timer on this reactor for an absolute monotonic_us() time
+void timer_arm(
+    event_timer_t* ptimer,
+    uint64_t deadline_us
+) {
+    if (!ptimer->armed) {
+        if (TIMER_COUNT == TIMER_CAP) {
+            TIMER_CAP = MAX(16, TIMER_CAP * 2);
+            TIMERS = (event_timer_t**)realloc(TIMERS, TIMER_CAP * sizeof(event_timer_t*));
+
+            fatal_assert(TIMERS != NULL, "Out Of Memory");
+        }
+
+        ptimer->armed = true;
+        ptimer->deadline_us = deadline_us;
+        timer_place(ptimer, TIMER_COUNT++);
+        timer_sift_up(ptimer->slot);
+        return;
+    }
+
+    uint64_t previous = ptimer->deadline_us;
+    ptimer->deadline_us = deadline_us;
+
+    if (deadline_us < previous) {
+        timer_sift_up(ptimer->slot);
+    } else {
+        timer_sift_down(ptimer->slot);
+    }
+}
+
+void timer_cancel(
+    event_timer_t* ptimer
+) {
+    if (!ptimer->armed) {
+        return;
+    }
+
+    int slot = ptimer->slot;
+    event_timer_t* last = TIMERS[--TIMER_COUNT];
+
+    ptimer->armed = false;
+
+    if (last == ptimer) {
+        return;
+    }
+
+    timer_place(last, slot);
+    timer_sift_up(slot);
+    timer_sift_down(last->slot);
+}
+
+// fires every timer that is due, a callback may arm its own timer again.
+// returns the microseconds until the next one, -1 when none is armed
+int64_t timer_run() {
+    uint64_t now = monotonic_us();
+
+    LOOP_NOW_US = now;
+
+    while (TIMER_COUNT != 0 && TIMERS[0]->deadline_us <= now) {
+        event_timer_t* ptimer = TIMERS[0];
+
+        timer_cancel(ptimer);
+        ptimer->callback(ptimer->arg);
+    }
+
+    if (TIMER_COUNT == 0) {
+        return -1;
+    }
+
+    return (int64_t)(TIMERS[0]->deadline_us - now);
+}
+
+//
+// Heartbeat
+//
+
+#define HEARTBEAT_INTERVAL_US 3000000
+
+void heartbeat(
+    void* arg
+) {
+    sockaddr_in broadcast_addr;
+    broadcast_addr.sin_family = AF_INET;
+    broadcast_addr.sin_port = htons(BROADCAST_PORT);
+    broadcast_addr.sin_addr.s_addr = INADDR_BROADCAST;
+
+    int ret = sendto(BROADCAST_FD, MAGIC_TEXT, strlen(MAGIC_TEXT), 0, 
+        (sockaddr*)&broadcast_addr, sizeof(sockaddr));
+
+    if (ret < 0) {
+        log_ns_at(LOG_WARN, "Heartbeat", "Failed To Send Magic: %s", strerror(errno));
+    } else {
+        log_ns_at(LOG_DEBUG, "Heartbeat", "Sent Magic!");
+    }
+
+    // counted from when it was due, so a late pass does not drift the schedule
+    timer_arm(&HEARTBEAT_TIMER, HEARTBEAT_TIMER.deadline_us + HEARTBEAT_INTERVAL_US);
+}
+
+
+//
+//  Client Interactions
+//
+
+void client_handle(
+    client_t* pclient,
+    const char* in_buffer,
+    size_t in_len
+) {
+    // "#tag verb args", the reply then starts with "#tag " so the client can
+    // tell which request it answers
+
+    if (in_buffer[0] == '#') {
+        size_t tag_len = strcspn(in_buffer, " ");
+
+        if (tag_len > MAX_TAG_LEN || in_buffer[tag_len] != ' ') {
+            client_send_code(pclient, CODE_403);
+            return;
+        }
+
+        client_queue(pclient, in_buffer, tag_len + 1);
+
+        in_buffer += tag_len + 1;
+        in_len -= tag_len + 1;
+    }
+
+    size_t verb_len = strcspn(in_buffer, " ");
+    command_t* command = command_find(in_buffer, verb_len);
+
+    if (command == NULL) {
+        client_send_code(pclient, CODE_400);
+        return;
+    }
+
+    const char* args = NULL;
+
+    if (in_buffer[verb_len] == ' ') {
+        args = in_buffer + verb_len + 1;
+    }
+
+    log_inet_at(LOG_DEBUG, pclient->addr, "Client Ran Command: %s, With Args: %s", command->verb, args);
+    
+    // commands on the store take their user's lane, see store_enter
+    STORE_EPOCH = 0;
+    command->callback(pclient, args);
+
+    // whatever this replied may rest on trades of the accounts it touched that
+    // are not durable yet, each was journaled before its lane was let go. the
+    // replies before it stay held too, they go out in order
+    pclient->hold_epoch = MAX(pclient->hold_epoch, STORE_EPOCH);
+}
+
+// the frame equivalent of client_handle, the body is all there
+void client_handle_frame(
+    client_t* pclient,
+    const frame_header_t* request,
+    const char* body
+) {
+    frame_command_t* command = request->opcode < OP_COUNT ? &FRAME_COMMANDS[request->opcode] : NULL;
+
+    log_inet_at(LOG_DEBUG, pclient->addr, "Client Ran Opcode %d, Request %u", 
+        (int)request->opcode, request->request_id);
+
+    if (command == NULL || command->callback == NULL) {
+        client_send_frame(pclient, request, STATUS_INVALID_COMMAND, NULL, 0);
+        return;
+    }
+
+    if (request->length != command->body_len) {
+        client_send_frame(pclient, request, STATUS_FORMAT_ERROR, NULL, 0);
+        return;
+    }
+
+    STORE_EPOCH = 0;
+    command->callback(pclient, request, body);
+
+    pclient->hold_epoch = MAX(pclient->hold_epoch, STORE_EPOCH);
+}
+
+// the slot holding `addr`, or the free slot where it would go
+addr_count_t* addr_slot(
+    in_addr_t addr
+) {
+    size_t i = (addr * 2654435761u) & (ADDR_CAP - 1);
+
+    while (ADDR_TABLE[i].count != 0 && ADDR_TABLE[i].addr != addr) {
+        i = (i + 1) & (ADDR_CAP - 1);
+    }
+
+    return &ADDR_TABLE[i];
+}
+
+void addr_grow() {
+    addr_count_t* table = ADDR_TABLE;
+    size_t cap = ADDR_CAP;
+
+    ADDR_CAP = MAX(cap * 2, 64);
+    ADDR_TABLE = (addr_count_t*)calloc(ADDR_CAP, sizeof(addr_count_t));
+
+    fatal_assert(ADDR_TABLE != NULL, "Out Of Memory");
+
+    for (size_t i = 0; i != cap; i++) {
+        if (table[i].count != 0) {
+            *addr_slot(table[i].addr) = table[i];
+        }
+    }
+
+    free(table);
+}
+
+// counts one more connection from `addr`, false when it already has its limit
+bool addr_take(
+    in_addr_t addr
+) {
+    pthread_mutex_lock(&ADDR_LOCK);
+
+    if ((ADDR_USED + 1) * 2 > ADDR_CAP) {
+        addr_grow();
+    }
+
+    addr_count_t* slot = addr_slot(addr);
+    bool taken = slot->count < MAX_CLIENTS_PER_ADDR;
+
+    if (taken) {
+        ADDR_USED += slot->count == 0;
+        slot->addr = addr;
+        slot->count++;
+    }
+
+    pthread_mutex_unlock(&ADDR_LOCK);
+
+    return taken;
+}
+
+void addr_give(
+    in_addr_t addr
+) {
+    pthread_mutex_lock(&ADDR_LOCK);
+
+    addr_count_t* slot = addr_slot(addr);
+
+    if (slot->count != 0 && --slot->count == 0) {
+        // shift later entries of the probe run back over the hole, so no
+        // lookup stops short of them
+        size_t hole = slot - ADDR_TABLE;
+        size_t i = hole;
+
+        ADDR_USED--;
+
+        while (true) {
+            i = (i + 1) & (ADDR_CAP - 1);
+
+            if (ADDR_TABLE[i].count == 0) {
+                break;
+            }
+
+            size_t home = (ADDR_TABLE[i].addr * 2654435761u) & (ADDR_CAP - 1);
+
+            // entries whose home lies cyclically in (hole, i] stay put
+            if (((i - home) & (ADDR_CAP - 1)) < ((i - hole) & (ADDR_CAP - 1))) {
+                continue;
+            }
+
+            ADDR_TABLE[hole] = ADDR_TABLE[i];
+            ADDR_TABLE[i].count = 0;
+            hole = i;
+        }
+    }
+
+    pthread_mutex_unlock(&ADDR_LOCK);
+}
+
+// counts the connection against the limits, false when it is over one of
+// them and should be shed before anything is spent on it
+bool client_admit(
+    const sockaddr_in* paddr
+) {
+    // every reactor gets an even share of the accept rate, a second's worth
+    // may come in at once
+
+    if (ACCEPT_RATE != 0) {
+        uint64_t now = monotonic_us();
+        uint64_t interval_us = 1000000ULL * REACTOR_COUNT / ACCEPT_RATE;
+
+        if (ACCEPT_TAT > now + 1000000) {
+            return false;
+        }
+
+        ACCEPT_TAT = MAX(ACCEPT_TAT, now) + interval_us;
+    }
+
+    int total = atomic_fetch_add(&CLIENT_TOTAL, 1);
+
+    if (MAX_CLIENTS != 0 && total >= MAX_CLIENTS) {
+        atomic_fetch_sub(&CLIENT_TOTAL, 1);
+        return false;
+    }
+
+    if (MAX_CLIENTS_PER_ADDR != 0 && !addr_take(paddr->sin_addr.s_addr)) {
+        atomic_fetch_sub(&CLIENT_TOTAL, 1);
+        return false;
+    }
+
+    return true;
+}
+
+void client_discharge(
+    const sockaddr_in* paddr
+) {
+    atomic_fetch_sub(&CLIENT_TOTAL, 1);
+
+    if (MAX_CLIENTS_PER_ADDR != 0) {
+        addr_give(paddr->sin_addr.s_addr);
+    }
+}
+
+// the timer only moves forward when it fires, reads just stamp last_active_us
+void client_idle(
+    void* arg
+) {
+    client_t* pclient = (client_t*)arg;
+    uint64_t deadline_us = pclient->last_active_us + IDLE_TIMEOUT_US;
+
+    if (deadline_us > LOOP_NOW_US) {
+        timer_arm(&pclient->idle_timer, deadline_us);
+        return;
+    }
+
+    log_inet(pclient->addr, "Client Idle For %lld Seconds", (long long)(IDLE_TIMEOUT_US / 1000000));
+    client_remove(pclient);
+}
+
+void client_accept(
+    int client_fd,
+    const sockaddr_in* pclient_addr
+) {
+    fatal_assert(client_fd >= 0 && pclient_addr != NULL, "Invalid Arguments");
+
+    if (!client_admit(pclient_addr)) {
+        log_inet_at(LOG_DEBUG, *pclient_addr, "Client Shed");
+        close(client_fd);
+        return;
+    }
+
+    client_t* new_client = client_alloc();
+
+    new_client->addr = *pclient_addr;
+    new_client->sock_fd = client_fd;
+
+    if (!BACKEND->attach(new_client)) {
+        log_inet_at(LOG_WARN, *pclient_addr, "Failed To Register Client: %s", strerror(errno));
+        client_free(new_client);
+        return;
+    }
+
+    if (IDLE_TIMEOUT_US != 0) {
+        new_client->last_active_us = monotonic_us();
+        new_client->idle_timer.callback = client_idle;
+        new_client->idle_timer.arg = new_client;
+        timer_arm(&new_client->idle_timer, new_client->last_active_us + IDLE_TIMEOUT_US);
+    }
+
+    log_inet(*pclient_addr, "Client Added To Pool");    
+}
+
+// closes the client, its slot is released at the end of the loop pass once
+// nothing in flight can still reference it
+void client_remove(
+    client_t* pclient
+) {
+    if (pclient->closed) {
+        return;
+    }
+
+    log_inet(pclient->addr, "Removing Client");
+
+    pclient->closed = true;
+
+    timer_cancel(&pclient->idle_timer);
+    BACKEND->detach(pclient);
+
+    pclient->next = CLOSED_LIST;
+    CLOSED_LIST = pclient;
+}
+
+// formats straight into the output, only a fresh chunk is needed when the
+// text does not fit in what is left of the last one
+void client_send(
+    client_t* pclient,
+    const char* fmt,
+    ...
+) {
+    if (pclient->closed) {
+        return;
+    }
+
+    va_list vargs;
+    va_list vargs_cpy;
+    va_start(vargs, fmt);
+    va_copy(vargs_cpy, vargs);
+
+    out_chunk_t* tail = pclient->out_tail;
+    size_t room = tail != NULL ? tail->cap - tail->len : 0;
+
+    int len = vsnprintf(room != 0 ? tail->data + tail->len : NULL, room, fmt, vargs);
+
+    fatal_assert(len >= 0, "Failed To Format Response");
+
+    // vsnprintf terminates what it writes, the terminator is never sent
+    if ((size_t)len >= room) {
+        vsnprintf(client_out_space(pclient, len + 1), len + 1, fmt, vargs_cpy);
+    }
+
+    client_out_commit(pclient, len);
+
+    va_end(vargs_cpy);
+    va_end(vargs);
+}
+
+void client_send_fixed(
+    client_t* pclient,
+    fixed_t value
+) {
+    char text[FIXED_TEXT_MAX];
+
+    client_queue(pclient, text, fixed_format(value, text));
+}
+
+// the text protocol's spelling of a STATUS_ code
+void client_send_status(
+    client_t* pclient,
+    int status
+) {
+    switch (status) {
+    case STATUS_OK:              client_send_code(pclient, CODE_200); break;
+    case STATUS_INVALID_COMMAND: client_send_code(pclient, CODE_400); break;
+    case STATUS_NO_USER:         client_send_code(pclient, CODE_401); break;
+    case STATUS_NO_BALANCE:      client_send_code(pclient, CODE_402); break;
+    case STATUS_NO_STOCK:        client_send_code(pclient, CODE_404); break;
+    default:                     client_send_code(pclient, CODE_403); break;
+    }
+}
+
+// a reply to `request` with `len` bytes of body, written straight into the output
+void client_send_frame(
+    client_t* pclient,
+    const frame_header_t* request,
+    int status,
+    const void* body,
+    uint32_t len
+) {
+    frame_header_t header = {
+        .length = htole32(len),
+        .opcode = htole16(request->opcode),
+        .status = htole16(status),
+        .request_id = htole32(request->request_id),
+    };
+
+    char* out = client_out_space(pclient, sizeof(header) + len);
+
+    memcpy(out, &header, sizeof(header));
+
+    if (len != 0) {
+        memcpy(out + sizeof(header), body, len);
+    }
+
+    client_out_commit(pclient, sizeof(header) + len);
+}
+
+#define RECV_CHUNK 4096
+#define MAX_COMMAND_LEN 65536
+
+// while paused, complete commands wait in the input buffer as well. reads
+// still in flight when the pause lands can add a little, past this the client
+// is just not reading its responses
+#define MAX_PAUSED_INPUT (1024 * 1024)
+
+#define OUT_CHUNK_SIZE 4096
+#define OUT_IOV_MAX 16
+
+// past the high water mark a client's commands stop being read or run until
+// it has consumed its responses down to the low water mark
+#define OUT_HIGH_WATER (256 * 1024)
+#define OUT_LOW_WATER (64 * 1024)
+
+#define CLIENT_PAGE_SLOTS 256
+
+// an input buffer no bigger than this stays with the slot for the next client
+#define CLIENT_KEEP_IN_CAP (4 * RECV_CHUNK)
+
+// refs carry this much of the generation, the top bits are left to io_uring's tags
+#define CLIENT_GENERATION_MASK 0x1fffffff
+
+/*
+Clients live in pages of fixed slots owned by the reactor, a slot keeps its
+address for the life of the reactor so the backends may hold plain pointers
+to it. Released slots go on a free list and are handed out again before a
+new page is made. Every release bumps the slot's generation, a ref names the
+slot and the generation together so it stops resolving once the slot has
+moved on to another connection.
+*/
+
+client_t* client_alloc() {
+    if (CLIENT_FREE == NULL) {
+        client_t* page = (client_t*)calloc(CLIENT_PAGE_SLOTS, sizeof(client_t));
+        client_t** pages = (client_t**)realloc(CLIENT_PAGES, (CLIENT_PAGE_COUNT + 1) * sizeof(client_t*));
+
+        fatal_assert(page != NULL && pages != NULL, "Out Of Memory");
+
+        CLIENT_PAGES = pages;
+
+        for (int i = CLIENT_PAGE_SLOTS - 1; i >= 0; i--) {
+            page[i].slot = CLIENT_PAGE_COUNT * CLIENT_PAGE_SLOTS + i;
+            page[i].next = CLIENT_FREE;
+            CLIENT_FREE = &page[i];
+        }
+
+        CLIENT_PAGES[CLIENT_PAGE_COUNT++] = page;
+    }
+
+    client_t* pclient = CLIENT_FREE;
+    CLIENT_FREE = pclient->next;
+
+    client_t reset = { 0 };
+    reset.slot = pclient->slot;
+    reset.generation = pclient->generation;
+    reset.in_buffer = pclient->in_buffer;
+    reset.in_cap = pclient->in_cap;
+    reset.in_use = true;
+
+    *pclient = reset;
+
+    return pclient;
+}
+
+void client_release(
+    client_t* pclient
+) {
+    pclient->in_use = false;
+    pclient->generation++;
+    pclient->next = CLIENT_FREE;
+    CLIENT_FREE = pclient;
+}
+
+uint64_t client_ref(
+    client_t* pclient
+) {
+    return (uint64_t)(pclient->generation & CLIENT_GENERATION_MASK) << 32 | (uint32_t)pclient->slot;
+}
+
+// NULL once the slot has been released or reused
+client_t* client_lookup(
+    uint64_t ref
+) {
+    uint32_t slot = (uint32_t)ref;
+
+    if (slot >= (uint32_t)CLIENT_PAGE_COUNT * CLIENT_PAGE_SLOTS) {
+        return NULL;
+    }
+
+    client_t* pclient = &CLIENT_PAGES[slot / CLIENT_PAGE_SLOTS][slot % CLIENT_PAGE_SLOTS];
+
+    if (!pclient->in_use || (pclient->generation & CLIENT_GENERATION_MASK) != ref >> 32) {
+        return NULL;
+    }
+
+    return pclient;
+}
+
+void client_free(
+    client_t* pclient
+) {
+    while (pclient->out_head != NULL) {
+        out_chunk_t* next = pclient->out_head->next;
+        free(pclient->out_head);
+        pclient->out_head = next;
+    }
+
+    close(pclient->sock_fd);
+    timer_cancel(&pclient->idle_timer);
+    client_discharge(&pclient->addr);
+
+    if (pclient->in_cap > CLIENT_KEEP_IN_CAP) {
+        free(pclient->in_buffer);
+        pclient->in_buffer = NULL;
+        pclient->in_cap = 0;
+    }
+
+    client_release(pclient);
+}
+
+// true while queued output waits on the journal, see journal_thread
+bool client_held(
+    client_t* pclient
+) {
+    return pclient->hold_epoch > JOURNAL_DURABLE;
+}
+
+// room for `len` more bytes at the end of the output, nothing is sent until
+// client_out_commit says how much of it was used
+char* client_out_space(
+    client_t* pclient,
+    size_t len
+) {
+    out_chunk_t* tail = pclient->out_tail;
+
+    if (tail == NULL || tail->cap - tail->len < len) {
+        size_t cap = MAX(OUT_CHUNK_SIZE, len);
+
+        out_chunk_t* chunk = (out_chunk_t*)malloc(sizeof(out_chunk_t) + cap);
+
+        fatal_assert(chunk != NULL, "Out Of Memory");
+
+        chunk->next = NULL;
+        chunk->len = 0;
+        chunk->off = 0;
+        chunk->cap = cap;
+
+        if (tail != NULL) {
+            tail->next = chunk;
+        } else {
+            pclient->out_head = chunk;
+        }
+
+        pclient->out_tail = tail = chunk;
+    }
+
+    return tail->data + tail->len;
+}
+
+void client_out_commit(
+    client_t* pclient,
+    size_t len
+) {
+    pclient->out_tail->len += len;
+    pclient->out_bytes += len;
+
+    if (!pclient->flush_queued) {
+        pclient->flush_queued = true;
+        pclient->flush_next = FLUSH_LIST;
+        FLUSH_LIST = pclient;
+    }
+
+    if (!pclient->paused && pclient->out_bytes >= OUT_HIGH_WATER) {
+        pclient->paused = true;
+        BACKEND->pause(pclient);
+    }
+}
+
+void client_queue(
+    client_t* pclient,
+    const char* data,
+    size_t len
+) {
+    if (pclient->closed) {
+        return;
+    }
+
+    memcpy(client_out_space(pclient, len), data, len);
+    client_out_commit(pclient, len);
+}
+
+// describes the unsent output, returns the number of iovecs filled
+int client_iov(
+    client_t* pclient,
+    struct iovec* iov,
+    int max
+) {
+    int count = 0;
+
+    for (out_chunk_t* chunk = pclient->out_head; chunk != NULL && count != max; chunk = chunk->next) {
+        if (chunk->len == chunk->off) {
+            continue;
+        }
+
+        iov[count].iov_base = chunk->data + chunk->off;
+        iov[count].iov_len = chunk->len - chunk->off;
+        count++;
+    }
+
+    return count;
+}
+
+// retires `len` bytes the socket accepted, the last chunk is kept for reuse
+void client_wrote(
+    client_t* pclient,
+    size_t len
+) {
+    pclient->out_bytes -= len;
+
+    while (len != 0) {
+        out_chunk_t* head = pclient->out_head;
+        size_t take = MIN(len, head->len - head->off);
+
+        head->off += take;
+        len -= take;
+
+        if (head->off != head->len) {
+            break;
+        }
+
+        if (head->next == NULL) {
+            head->off = head->len = 0;
+            break;
+        }
+
+        pclient->out_head = head->next;
+        free(head);
+    }
+
+    if (pclient->paused && !pclient->closed && pclient->out_bytes <= OUT_LOW_WATER) {
+        pclient->paused = false;
+
+        // commands that were already buffered go first
+        client_process(pclient);
+
+        if (!pclient->paused && !pclient->closed) {
+            BACKEND->resume(pclient);
+        }
+    }
+}
+
+// makes room for `extra` more bytes past in_len, plus a terminator
+void client_reserve(
+    client_t* pclient,
+    size_t extra
+) {
+    size_t needed = pclient->in_len + extra + 1;
+
+    if (needed <= pclient->in_cap) {
+        return;
+    }
+
+    size_t cap = MAX(pclient->in_cap, 1024);
+
+    while (cap < needed) {
+        cap *= 2;
+    }
+
+    pclient->in_buffer = (char*)realloc(pclient->in_buffer, cap);
+
+    fatal_assert(pclient->in_buffer != NULL, "Out Of Memory");
+
+    pclient->in_cap = cap;
+}
+
+// runs every complete command sitting in the input buffer. commands end with
+// a newline or MAGIC_EOR, whatever trails the last one waits for more data
+void client_process(
+    client_t* pclient
+) {
+    char* buffer = pclient->in_buffer;
+    size_t start = 0;
+    size_t i = pclient->in_scan;
+
+    for (; i < pclient->in_len && !pclient->closed && !pclient->paused && !pclient->binary; i++) {
+        if (buffer[i] != '\n' && buffer[i] != MAGIC_EOR) {
+            continue;
+        }
+
+        size_t end = i;
+
+        if (end > start && buffer[end - 1] == '\r') {
+            end--;
+        }
+
+        buffer[end] = '\0';
+
+        if (end != start) {
+            client_handle(pclient, buffer + start, end - start);
+        }
+
+        start = i + 1;
+    }
+
+    // whatever follows the switch to frames is read as frames
+    if (pclient->binary) {
+        start = client_process_frames(pclient, start);
+        i = start;
+    }
+
+    if (pclient->closed) {
+        return;
+    }
+
+    if (start != 0) {
+        pclient->in_len -= start;
+        memmove(buffer, buffer + start, pclient->in_len);
+    }
+
+    pclient->in_scan = i - start;
+
+    if (pclient->paused && pclient->in_len > MAX_PAUSED_INPUT) {
+        log_inet_at(LOG_WARN, pclient->addr, "Unread Input Exceeds %d Bytes While Paused", MAX_PAUSED_INPUT);
+        client_send_code(pclient, CODE_403);
+        client_remove(pclient);
+    } else if (!pclient->paused && pclient->in_len > MAX_COMMAND_LEN) {
+        log_inet_at(LOG_WARN, pclient->addr, "Command Exceeds %d Bytes", MAX_COMMAND_LEN);
+        client_send_code(pclient, CODE_403);
+        client_remove(pclient);
+    }
+}
+
+// runs every complete frame from `start` on, returns where the first
+// incomplete one begins
+size_t client_process_frames(
+    client_t* pclient,
+    size_t start
+) {
+    const char* buffer = pclient->in_buffer;
+
+    while (!pclient->closed && !pclient->paused && pclient->in_len - start >= sizeof(frame_header_t)) {
+        frame_header_t request;
+        memcpy(&request, buffer + start, sizeof(request));
+
+        request.length = le32toh(request.length);
+        request.opcode = le16toh(request.opcode);
+        request.request_id = le32toh(request.request_id);
+
+        // nothing could ever need this much, the stream is not worth following
+        if (request.length > FRAME_MAX_BODY) {
+            log_inet_at(LOG_WARN, pclient->addr, "Frame Exceeds %d Bytes", FRAME_MAX_BODY);
+            client_send_frame(pclient, &request, STATUS_FORMAT_ERROR, NULL, 0);
+            client_remove(pclient);
+            break;
+        }
+
+        if (pclient->in_len - start < sizeof(request) + request.length) {
+            break;
+        }
+
+        client_handle_frame(pclient, &request, buffer + start + sizeof(request));
+
+        start += sizeof(request) + request.length;
+    }
+
+    return start;
+}
+
+void client_ingest(
+    client_t* pclient,
+    const char* data,
+    size_t len
+) {
+    client_reserve(pclient, len);
+
+    memcpy(pclient->in_buffer + pclient->in_len, data, len);
+    pclient->in_len += len;
+    pclient->last_active_us = LOOP_NOW_US;
+
+    client_process(pclient);
+}
+
+void client_recv(
+    client_t* pclient
+) {
+    if (pclient == NULL) {
+        return;
+    }
+
+    // edge triggered, so keep reading until the socket runs dry or the
+    // client has too many unread responses
+    while (!pclient->closed && !pclient->paused) {
+        client_reserve(pclient, RECV_CHUNK);
+
+        int ret = recv(pclient->sock_fd, pclient->in_buffer + pclient->in_len, 
+            RECV_CHUNK, MSG_DONTWAIT);
+
+        if (ret <= 0) {
+            if (ret == 0 || !FD_WOULDBLOCK) {
+                log_inet_at(LOG_WARN, pclient->addr, "Failed To Recieve Data: %s", 
+                    ret == 0 ? "Connection Closed" : strerror(errno));
+                client_remove(pclient);
+            }
+
+            return;
+        }
+
+        pclient->in_len += ret;
+        pclient->last_active_us = LOOP_NOW_US;
+
+        client_process(pclient);
+    }
+}
+
+//
+// Epoll Backend
+//
+
+#define MAX_EVENTS 256
+
+bool epoll_init() {
+    if ((EPOLL_FD = epoll_create1(0)) < 0) {
+        return false;
+    }
+
+    // the listener is tagged NULL and the wake eventfd with the reactor itself
+
+    struct epoll_event server_event = { 0 };
+    server_event.events = EPOLLIN | EPOLLET;
+    server_event.data.ptr = NULL;
+
+    struct epoll_event wake_event = { 0 };
+    wake_event.events = EPOLLIN | EPOLLET;
+    wake_event.data.ptr = REACTOR;
+
+    if (epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, REACTOR->server_fd, &server_event) < 0 ||
+        epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, REACTOR->wake_fd, &wake_event) < 0) {
+        close(EPOLL_FD);
+        return false;
+    }
+
+    return true;
+}
+
+void epoll_deinit() {
+    close(EPOLL_FD);
+}
+
+bool epoll_attach(
+    client_t* pclient
+) {
+    // edge triggered, so EPOLLOUT only fires when a full socket drains
+    struct epoll_event event = { 0 };
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = pclient;
+
+    return epoll_ctl(EPOLL_FD, EPOLL_CTL_ADD, pclient->sock_fd, &event) == 0;
+}
+
+// the reply to quit still goes out from reactor_flush, the descriptor itself
+// is closed when the client is freed
+void epoll_detach(
+    client_t* pclient
+) {
+    epoll_ctl(EPOLL_FD, EPOLL_CTL_DEL, pclient->sock_fd, NULL);
+}
+
+void epoll_flush(
+    client_t* pclient
+) {
+    struct iovec iov[OUT_IOV_MAX];
+
+    // a write can unpause the client and run buffered trades, whose replies
+    // then wait for the journal. client_out_commit has queued it again for that
+    while (pclient->out_bytes != 0 && !client_held(pclient)) {
+        int count = client_iov(pclient, iov, LENGTHOF(iov));
+        ssize_t ret = writev(pclient->sock_fd, iov, count);
+
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            // the rest goes out on EPOLLOUT
+            if (!FD_WOULDBLOCK) {
+                log_inet_at(LOG_WARN, pclient->addr, "Failed To Send Data: %s", strerror(errno));
+                client_remove(pclient);
+            }
+
+            return;
+        }
+
+        client_wrote(pclient, ret);
+    }
+}
+
+// reads stop on their own while paused, see client_recv
+void epoll_pause(
+    client_t* pclient
+) {
+}
+
+// edge triggered, whatever arrived while paused raises no new event
+void epoll_resume(
+    client_t* pclient
+) {
+    client_recv(pclient);
+}
+
+void client_event(
+    client_t* pclient,
+    uint32_t events
+) {
+    if (pclient->closed) {
+        return;
+    }
+
+    if ((events & EPOLLOUT) && pclient->out_bytes != 0 && !client_held(pclient)) {
+        epoll_flush(pclient);
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        client_recv(pclient);
+    }
+}
+
+void server_accept() {
+    while (true) {
+        sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(sockaddr);
+        int client_fd = accept4(REACTOR->server_fd, (sockaddr*)&client_addr, 
+            &client_addr_len, SOCK_NONBLOCK);        
+
+        if (client_fd >= 0) {
+            client_accept(client_fd, &client_addr);
+            continue;
+        }
+
+        if (FD_WOULDBLOCK) {
+            return;
+        }
+
+        // the peer hung up before we got to it, or we are out of descriptors,
+        // neither should take the whole server down
+        if (errno == ECONNABORTED || errno == EINTR || errno == EPROTO) {
+            continue;
+        }
+
+        if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+            log_ns_at(LOG_WARN, "Accept", "Failed To Accept Client: %s", strerror(errno));
+            return;
+        }
+
+        fatal_error("Failed To Accept Client");
+    }
+}
+
+void epoll_run() {
+    struct epoll_event events[MAX_EVENTS];
+
+    int64_t timeout_us = reactor_end_pass();
+
+    while (RUNNING) {
+        // sleep until something is readable or the next timer is due. timers
+        // only need milliseconds, rounded up so one never fires early, and
+        // plain epoll_wait works on every kernel
+
+        int timeout_ms = timeout_us < 0 ? -1 : (int)MIN((timeout_us + 999) / 1000, INT32_MAX);
+        int count = epoll_wait(EPOLL_FD, events, LENGTHOF(events), timeout_ms);
+
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            fatal_error("Failed To Wait On Events");
+        }
+
+        reactor_begin_pass();
+
+        for (int i = 0; i != count; i++) {
+            if (events[i].data.ptr == NULL) {
+                server_accept();
+            } else if (events[i].data.ptr == REACTOR) {
+                reactor_drain_wake();
+            } else {
+                client_event((client_t*)events[i].data.ptr, events[i].events);
+            }
+        }
+
+        timeout_us = reactor_end_pass();
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+//
+// io_uring Backend
+//
+
+/*
+Talks to the kernel directly rather than through liburing, the surface used
+here is small: one multishot accept on the reactor's listener, a poll on its
+wake eventfd, one multishot recv per client drawing from a provided buffer
+ring, and at most one writev per client covering its queued output. Every SQE
+produced during a loop pass goes out with the same io_uring_enter that waits
+for the next completions.
+
+Completions carry a client ref in user_data with the operation packed into
+the low bits. A completion whose ref no longer resolves belongs to a
+connection that is gone, its slot may already serve another.
+*/
+
+#define URING_ENTRIES 256
+#define URING_BUF_COUNT 1024 // must be a power of two
+#define URING_BUF_SIZE 1024
+#define URING_BUF_GROUP 0
+
+#define URING_TAG_ACCEPT 1
+#define URING_TAG_RECV 2
+#define URING_TAG_SEND 3
+#define URING_TAG_WAKE 4
+#define URING_TAG_CANCEL 5
+#define URING_TAG_MASK 7
+
+
+// a negative timeout waits as long as it takes
+int uring_enter(
+    unsigned min_complete,
+    int64_t timeout_us
+) {
+    __atomic_store_n(URING.ksq_tail, URING.sq_tail, __ATOMIC_RELEASE);
+
+    unsigned to_submit = URING.sq_tail - __atomic_load_n(URING.ksq_head, __ATOMIC_ACQUIRE);
+
+    struct __kernel_timespec ts = { 0 };
+    ts.tv_sec = timeout_us / 1000000;
+    ts.tv_nsec = (timeout_us % 1000000) * 1000;
+
+    struct io_uring_getevents_arg arg = { 0 };
+
+    if (timeout_us >= 0) {
+        arg.ts = (uint64_t)(uintptr_t)&ts;
+    }
+
+    unsigned flags = IORING_ENTER_EXT_ARG;
+
+    if (min_complete != 0) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+
+    return syscall(__NR_io_uring_enter, URING.fd, to_submit, min_complete, 
+        flags, &arg, sizeof(arg));
+}
+
+struct io_uring_sqe* uring_sqe() {
+    // ring is full, hand what we have to the kernel without waiting
+    while (URING.sq_tail - __atomic_load_n(URING.ksq_head, __ATOMIC_ACQUIRE) >= URING.sq_entries) {
+        if (uring_enter(0, 0) < 0 && errno != EINTR && errno != EBUSY) {
+            fatal_error("Failed To Submit To io_uring");
+        }
+    }
+
+    struct io_uring_sqe* sqe = &URING.sqes[URING.sq_tail & URING.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    URING.sq_tail++;
+
+    return sqe;
+}
+
+void uring_buf_recycle(
+    unsigned short bid
+) {
+    struct io_uring_buf* buf = &URING.buf_ring->bufs[URING.buf_tail & (URING_BUF_COUNT - 1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(URING.bufs + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+
+    URING.buf_tail++;
+
+    __atomic_store_n(&URING.buf_ring->tail, URING.buf_tail, __ATOMIC_RELEASE);
+}
+
+void uring_arm_accept() {
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = REACTOR->server_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = URING_TAG_ACCEPT;
+}
+
+void uring_arm_wake() {
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = REACTOR->wake_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_TAG_WAKE;
+}
+
+void uring_arm_recv(
+    client_t* pclient
+) {
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = pclient->sock_fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+    sqe->user_data = client_ref(pclient) << 3 | URING_TAG_RECV;
+
+    pclient->recv_armed = true;
+    pclient->inflight++;
+}
+
+void uring_arm_writev(
+    client_t* pclient
+) {
+    struct io_uring_sqe* sqe = uring_sqe();
+
+    // the kernel copies the iovecs at submission, one set per SQE slot is enough
+    struct iovec* iov = URING.iovs + (sqe - URING.sqes) * OUT_IOV_MAX;
+
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = pclient->sock_fd;
+    sqe->addr = (uint64_t)(uintptr_t)iov;
+    sqe->len = client_iov(pclient, iov, OUT_IOV_MAX);
+    sqe->off = (uint64_t)-1;
+    sqe->user_data = client_ref(pclient) << 3 | URING_TAG_SEND;
+
+    pclient->out_busy = true;
+    pclient->inflight++;
+}
+
+bool uring_init() {
+    struct io_uring_params params = { 0 };
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_ENTRIES * 4;
+
+    if ((URING.fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params)) < 0) {
+        return false;
+    }
+
+    int required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+
+    if ((params.features & required) != required) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    // multishot recv arrived in 6.0 alongside SEND_ZC, use one to detect the other
+
+    struct io_uring_probe* probe = calloc(1, sizeof(struct io_uring_probe) + 
+        256 * sizeof(struct io_uring_probe_op));
+
+    fatal_assert(probe != NULL, "Out Of Memory");
+
+    int ret = syscall(__NR_io_uring_register, URING.fd, IORING_REGISTER_PROBE, probe, 256);
+    bool supported = ret >= 0 && probe->last_op >= IORING_OP_SEND_ZC;
+
+    free(probe);
+
+    if (!supported) {
+        errno = ENOTSUP;
+        goto fail;
+    }
+
+    // rings
+
+    URING.ring_size = MAX(
+        params.sq_off.array + params.sq_entries * sizeof(unsigned),
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+
+    URING.ring_ptr = mmap(NULL, URING.ring_size, PROT_READ | PROT_WRITE, 
+        MAP_SHARED | MAP_POPULATE, URING.fd, IORING_OFF_SQ_RING);
+
+    if (URING.ring_ptr == MAP_FAILED) {
+        URING.ring_ptr = NULL;
+        goto fail;
+    }
+
+    URING.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    URING.sqes = mmap(NULL, URING.sqes_size, PROT_READ | PROT_WRITE, 
+        MAP_SHARED | MAP_POPULATE, URING.fd, IORING_OFF_SQES);
+
+    if (URING.sqes == MAP_FAILED) {
+        URING.sqes = NULL;
+        goto fail;
+    }
+
+    char* ring = (char*)URING.ring_ptr;
+
+    URING.sq_entries = params.sq_entries;
+    URING.sq_mask = *(unsigned*)(ring + params.sq_off.ring_mask);
+    URING.ksq_head = (unsigned*)(ring + params.sq_off.head);
+    URING.ksq_tail = (unsigned*)(ring + params.sq_off.tail);
+    URING.sq_tail = *URING.ksq_tail;
+
+    unsigned* sq_array = (unsigned*)(ring + params.sq_off.array);
+
+    for (unsigned i = 0; i != params.sq_entries; i++) {
+        sq_array[i] = i;
+    }
+
+    URING.cq_mask = *(unsigned*)(ring + params.cq_off.ring_mask);
+    URING.kcq_head = (unsigned*)(ring + params.cq_off.head);
+    URING.kcq_tail = (unsigned*)(ring + params.cq_off.tail);
+    URING.cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+    URING.iovs = (struct iovec*)calloc((size_t)params.sq_entries * OUT_IOV_MAX, sizeof(struct iovec));
+
+    fatal_assert(URING.iovs != NULL, "Out Of Memory");
+
+    // provided buffers
+
+    URING.buf_ring = mmap(NULL, URING_BUF_COUNT * sizeof(struct io_uring_buf), 
+        PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (URING.buf_ring == MAP_FAILED) {
+        URING.buf_ring = NULL;
+        goto fail;
+    }
+
+    URING.bufs = (char*)malloc((size_t)URING_BUF_COUNT * URING_BUF_SIZE);
+
+    fatal_assert(URING.bufs != NULL, "Out Of Memory");
+
+    struct io_uring_buf_reg reg = { 0 };
+    reg.ring_addr = (uint64_t)(uintptr_t)URING.buf_ring;
+    reg.ring_entries = URING_BUF_COUNT;
+    reg.bgid = URING_BUF_GROUP;
+
+    if (syscall(__NR_io_uring_register, URING.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        goto fail;
+    }
+
+    for (unsigned i = 0; i != URING_BUF_COUNT; i++) {
+        uring_buf_recycle(i);
+    }
+
+    // a non-blocking socket makes io_uring hand back EAGAIN instead of waiting
+
+    int server_fd = REACTOR->server_fd;
+
+    if (fcntl(server_fd, F_SETFL, fcntl(server_fd, F_GETFL) & ~O_NONBLOCK) == -1) {
+        goto fail;
+    }
+
+    uring_arm_accept();
+    uring_arm_wake();
+
+    return true;
+
+fail:
+    ret = errno;
+    uring_deinit();
+    errno = ret;
+    return false;
+}
+
+void uring_deinit() {
+    if (URING.fd >= 0) {
+        close(URING.fd);
+    }
+
+    if (URING.ring_ptr != NULL) {
+        munmap(URING.ring_ptr, URING.ring_size);
+    }
+
+    if (URING.sqes != NULL) {
+        munmap(URING.sqes, URING.sqes_size);
+    }
+
+    if (URING.buf_ring != NULL) {
+        munmap(URING.buf_ring, URING_BUF_COUNT * sizeof(struct io_uring_buf));
+    }
+
+    free(URING.bufs);
+    free(URING.iovs);
+
+    memset(&URING, 0, sizeof(URING));
+    URING.fd = -1;
+}
+
+bool uring_attach(
+    client_t* pclient
+) {
+    uring_arm_recv(pclient);
+    return true;
+}
+
+// shutting the socket down completes the armed recv, the client is freed once
+// every operation referencing it has come back. queued responses go out first
+void uring_detach(
+    client_t* pclient
+) {
+    if (pclient->out_bytes == 0 && !pclient->out_busy) {
+        shutdown(pclient->sock_fd, SHUT_RDWR);
+    }
+}
+
+void uring_flush(
+    client_t* pclient
+) {
+    if (pclient->out_bytes != 0 && !pclient->out_busy) {
+        uring_arm_writev(pclient);
+    }
+}
+
+void uring_pause(
+    client_t* pclient
+) {
+    if (!pclient->recv_armed) {
+        return;
+    }
+
+    struct io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = client_ref(pclient) << 3 | URING_TAG_RECV;
+    sqe->user_data = URING_TAG_CANCEL;
+}
+
+void uring_resume(
+    client_t* pclient
+) {
+    if (!pclient->recv_armed) {
+        uring_arm_recv(pclient);
+    }
+}
+
+void uring_complete_accept(
+    const struct io_uring_cqe* cqe
+) {
+    if (cqe->res >= 0) {
+        sockaddr_in client_addr = { 0 };
+        socklen_t client_addr_len = sizeof(sockaddr);
+
+        getpeername(cqe->res, (sockaddr*)&client_addr, &client_addr_len);
+        client_accept(cqe->res, &client_addr);
+    } else if (cqe->res != -ECONNABORTED && cqe->res != -EINTR) {
+        log_ns_at(LOG_WARN, "Accept", "Failed To Accept Client: %s", strerror(-cqe->res));
+    }
+
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        uring_arm_accept();
+    }
+}
+
+void uring_complete_recv(
+    client_t* pclient,
+    const struct io_uring_cqe* cqe
+) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        pclient->recv_armed = false;
+        pclient->inflight--;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        char* in_buffer = URING.bufs + (size_t)bid * URING_BUF_SIZE;
+
+        if (cqe->res > 0 && !pclient->closed) {
+            client_ingest(pclient, in_buffer, cqe->res);
+        }
+
+        uring_buf_recycle(bid);
+    }
+
+    if (pclient->closed) {
         return;
     }
-    
-    client_send(pclient, CODE_200);
-    
-    RUNNING = false;
+
+    // ENOBUFS only means we outran the buffer ring and ECANCELED that the
+    // client was paused, neither ends the connection
+
+    if (cqe->res == 0 || (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED)) {
+        log_inet_at(LOG_WARN, pclient->addr, "Failed To Recieve Data: %s", 
+            cqe->res == 0 ? "Connection Closed" : strerror(-cqe->res));
+        client_remove(pclient);
+    } else if (!pclient->recv_armed && !pclient->paused) {
+        uring_arm_recv(pclient);
+    }
 }
 
-void quit_command(
-    client_t* pclient, 
-    const char* args
-) { 
-    if (args != NULL) {
-        client_send(pclient, CODE_403);
+void uring_complete_writev(
+    client_t* pclient,
+    const struct io_uring_cqe* cqe
+) {
+    pclient->out_busy = false;
+    pclient->inflight--;
+
+    if (cqe->res < 0) {
+        if (!pclient->closed) {
+            log_inet_at(LOG_WARN, pclient->addr, "Failed To Send Data: %s", strerror(-cqe->res));
+            client_remove(pclient);
+        }
+
+        client_wrote(pclient, pclient->out_bytes);
+        shutdown(pclient->sock_fd, SHUT_RDWR);
         return;
-    }    
+    }
 
-    client_send(pclient, CODE_200);
+    client_wrote(pclient, cqe->res);
 
-    client_remove(pclient);
-    free(pclient);
+    // held output goes out from reactor_flush once it is durable
+    if (pclient->out_bytes != 0 && !client_held(pclient)) {
+        uring_arm_writev(pclient);
+    } else if (pclient->closed && pclient->out_bytes == 0) {
+        shutdown(pclient->sock_fd, SHUT_RDWR);
+    }
 }
 
-//
-//
+void uring_reap() {
+    unsigned head = *URING.kcq_head;
+    unsigned tail = __atomic_load_n(URING.kcq_tail, __ATOMIC_ACQUIRE);
 
-void heartbeat() {
-    sockaddr_in broadcast_addr;
-    broadcast_addr.sin_family = AF_INET;
-    broadcast_addr.sin_port = htons(BROADCAST_PORT);
-    broadcast_addr.sin_addr.s_addr = INADDR_BROADCAST;
+    while (head != tail) {
+        struct io_uring_cqe cqe = URING.cqes[head & URING.cq_mask];
 
-    int ret = sendto(BROADCAST_FD, MAGIC_TEXT, strlen(MAGIC_TEXT), 0, 
-        (sockaddr*)&broadcast_addr, sizeof(sockaddr));
+        head++;
+        __atomic_store_n(URING.kcq_head, head, __ATOMIC_RELEASE);
 
-    if (ret < 0) {
-        log_ns("Heartbeat", "Failed To Send Magic: %s", strerror(errno));
-    } else {
-        log_ns("Heartbeat", "Sent Magic!");
+        uint64_t tag = cqe.user_data & URING_TAG_MASK;
+        client_t* pclient = client_lookup(cqe.user_data >> 3);
+
+        if (tag == URING_TAG_ACCEPT) {
+            uring_complete_accept(&cqe);
+            continue;
+        }
+
+        if ((tag == URING_TAG_RECV || tag == URING_TAG_SEND) && pclient == NULL) {
+            if (cqe.flags & IORING_CQE_F_BUFFER) {
+                uring_buf_recycle(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            }
+
+            log_ns_at(LOG_WARN, "Reactor", "Dropped Completion For A Released Client");
+            continue;
+        }
+
+        if (tag == URING_TAG_WAKE) {
+            reactor_drain_wake();
+            uring_arm_wake();
+        } else if (tag == URING_TAG_RECV) {
+            uring_complete_recv(pclient, &cqe);
+        } else if (tag == URING_TAG_SEND) {
+            uring_complete_writev(pclient, &cqe);
+        }
+    }
+}
+
+void uring_run() {
+    int64_t timeout_us = reactor_end_pass();
+
+    while (RUNNING) {
+        // submits everything queued since the last pass, then sleeps until a
+        // completion arrives or the next heartbeat is due
+
+        if (uring_enter(1, timeout_us) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+            fatal_error("Failed To Enter io_uring");
+        }
+
+        reactor_begin_pass();
+        uring_reap();
+        timeout_us = reactor_end_pass();
     }
+
+    // hand over whatever the last pass queued, e.g. the reply to shutdown
+    uring_enter(0, 0);
 }
 
+#endif
+
 //
-//  Client Interactions
+// Reactors
 //
 
-void client_handle(
-    client_t* pclient,
-    const char* in_buffer,
-    size_t in_len
+void reactor_listen(
+    reactor_t* preactor
 ) {
-    size_t command_idx = 0;
-    while (command_idx != LENGTHOF(COMMANDS)) {
-        if (strincmp(COMMANDS[command_idx].prefix, in_buffer, 
-            strlen(COMMANDS[command_idx].prefix)) == 0) {
-            break;
-        }
-        command_idx++;
+    if ((preactor->server_fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
+        fatal_error("Failed To Create Server Socket");        
     }
 
-    if (command_idx == LENGTHOF(COMMANDS)) {
-        client_send(pclient, CODE_400);
-        return;
+    // every reactor binds the same port, the kernel spreads connections across them
+
+    int opt_true = 1;
+    if (setsockopt(preactor->server_fd, SOL_SOCKET, SO_REUSEADDR, &opt_true, sizeof(opt_true)) < 0 ||
+        setsockopt(preactor->server_fd, SOL_SOCKET, SO_REUSEPORT, &opt_true, sizeof(opt_true)) < 0) {
+        fatal_error("Failed To Enable Port Reuse On Server Socket");
+    }
+
+    sockaddr_in server_addr = { 0 };
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+
+    if (bind(preactor->server_fd, (sockaddr*)&server_addr, sizeof(sockaddr)) < 0) {
+        fatal_error("Failed To Bind Server Socket");
     }
 
-    const char* args = strchr(in_buffer, ' ');
+    if (listen(preactor->server_fd, SOMAXCONN) < 0) {
+        fatal_error("Failed To Listen On Server Socket");
+    }
 
-    if (args != NULL) {
-        args++;
+    if (fcntl(preactor->server_fd, F_SETFL, fcntl(preactor->server_fd, F_GETFL) | O_NONBLOCK) == -1) {
+        fatal_error("Failed To Put Server Socket Into Non-Blocking Mode");
     }
 
-    log_inet(pclient->addr, "Client Ran Command: %s, With Args: %s", COMMANDS[command_idx].prefix, args);
-    
-    COMMANDS[command_idx].callback(pclient, args);
+    if ((preactor->wake_fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+        fatal_error("Failed To Create Wake Event");
+    }
 }
 
-void client_accept(
-    int client_fd,
-    const sockaddr_in* pclient_addr
+void reactor_wake(
+    reactor_t* preactor
 ) {
-    fatal_assert(client_fd >= 0 && pclient_addr != NULL, "Invalid Arguments");
+    uint64_t one = 1;
 
-    client_t* new_client = (client_t*)calloc(1, sizeof(client_t));
+    if (write(preactor->wake_fd, &one, sizeof(one)) < 0 && !FD_WOULDBLOCK) {
+        log_ns_at(LOG_WARN, "Reactor", "Failed To Wake Reactor %d: %s", preactor->id, strerror(errno));
+    }
+}
 
-    fatal_assert(new_client != NULL, "Out Of Memory");
+// knocks every reactor out of its wait so it notices RUNNING has changed
+void reactor_wake_all() {
+    for (int i = 0; i != REACTOR_COUNT; i++) {
+        reactor_wake(&REACTORS[i]);
+    }
+}
 
-    new_client->addr = *pclient_addr;
-    new_client->sock_fd = client_fd;
+// wakes only the reactors holding output that `epoch` has made durable, see
+// reactor_flush for the other half of the handshake
+void reactor_wake_durable(
+    uint64_t epoch
+) {
+    for (int i = 0; i != REACTOR_COUNT; i++) {
+        uint64_t waiting = atomic_load(&REACTORS[i].waiting_epoch);
 
-    if (CLIENT_LIST != NULL) {
-        CLIENT_LIST->prev = new_client;
-        new_client->next = CLIENT_LIST;
+        if (waiting != 0 && waiting <= epoch) {
+            reactor_wake(&REACTORS[i]);
+        }
     }
+}
 
-    CLIENT_LIST = new_client;
+void reactor_drain_wake() {
+    uint64_t count;
 
-    log_inet(*pclient_addr, "Client Added To Pool");    
+    while (read(REACTOR->wake_fd, &count, sizeof(count)) > 0) {
+        // nothing, the loop condition does the work
+    }
 }
 
-void client_remove(
-    client_t* pclient
-) {
-    log_inet(pclient->addr, "Removing Client");
+// pushes out everything queued during this pass, then frees closed clients
+// that nothing in flight refers to any more. output waiting on the journal
+// stays queued, the reactor publishes the oldest epoch it waits on and the
+// flusher wakes it once that epoch is durable
+void reactor_flush() {
+    uint64_t waiting;
+
+    do {
+        while (HELD_LIST != NULL) {
+            client_t* pclient = HELD_LIST;
+
+            HELD_LIST = pclient->flush_next;
+            pclient->flush_next = FLUSH_LIST;
+            FLUSH_LIST = pclient;
+        }
 
-    if (pclient->prev != NULL) {
-        pclient->prev->next = pclient->next;
+        waiting = 0;
+
+        while (FLUSH_LIST != NULL) {
+            client_t* pclient = FLUSH_LIST;
+
+            FLUSH_LIST = pclient->flush_next;
+
+            if (client_held(pclient)) {
+                pclient->flush_next = HELD_LIST;
+                HELD_LIST = pclient;
+
+                if (waiting == 0 || pclient->hold_epoch < waiting) {
+                    waiting = pclient->hold_epoch;
+                }
+                continue;
+            }
+
+            pclient->flush_queued = false;
+
+            BACKEND->flush(pclient);
+        }
+
+        // the flusher publishes JOURNAL_DURABLE before reading waiting_epoch,
+        // so whichever of the two goes second sees the other. an epoch that
+        // landed in between is picked up by going round again
+
+        atomic_store(&REACTOR->waiting_epoch, waiting);
+    } while (waiting != 0 && waiting <= atomic_load(&JOURNAL_DURABLE));
+
+    client_t** link = &CLOSED_LIST;
+
+    while (*link != NULL) {
+        client_t* pclient = *link;
+
+        if (pclient->inflight != 0 || pclient->flush_queued) {
+            link = &pclient->next;
+            continue;
+        }
+
+        *link = pclient->next;
+        client_free(pclient);
     }
+}
+
+// called as soon as the loop wakes, the wait may have been long and reads
+// stamp their clients with LOOP_NOW_US
+void reactor_begin_pass() {
+    LOOP_NOW_US = monotonic_us();
+}
 
-    if (pclient->next != NULL) {
-        pclient->next->prev = pclient->prev;
+// the bookkeeping after every pass of the event loop. returns how long the
+// loop may sleep in microseconds, -1 for as long as it likes
+int64_t reactor_end_pass() {
+    // the loop is about to stop, the last replies still go out durable
+    if (!RUNNING) {
+        journal_wait();
     }
 
-    if (pclient == CLIENT_LIST) {
-        CLIENT_LIST = pclient->next;
+    int64_t timeout_us = timer_run();
+
+    reactor_flush();
+
+    return timeout_us;
+}
+
+void reactor_cleanup() {
+    // stop the event loop first, nothing may complete against freed clients
+
+    BACKEND->deinit();
+
+    for (int i = 0; i != CLIENT_PAGE_COUNT; i++) {
+        for (int j = 0; j != CLIENT_PAGE_SLOTS; j++) {
+            client_t* pclient = &CLIENT_PAGES[i][j];
+
+            if (pclient->in_use) {
+                client_free(pclient);
+            }
+
+            free(pclient->in_buffer);
+        }
+
+        free(CLIENT_PAGES[i]);
     }
+
+    free(CLIENT_PAGES);
+
+    CLIENT_PAGES = NULL;
+    CLIENT_PAGE_COUNT = 0;
+    CLIENT_FREE = NULL;
+    CLOSED_LIST = NULL;
+    FLUSH_LIST = NULL;
+
+    free(TIMERS);
+    TIMERS = NULL;
+    TIMER_COUNT = 0;
+    TIMER_CAP = 0;
+
+    // the wake fd stays open for the flusher, see deinitialize
+    close(REACTOR->server_fd);
 }
 
-void client_send(
-    client_t* pclient,
-    const char* fmt,
-    ...
+void* reactor_thread(
+    void* arg
 ) {
-    va_list vargs;
-    va_list vargs_cpy;
-    va_start(vargs, fmt);
-    va_copy(vargs_cpy, vargs);
+    REACTOR = (reactor_t*)arg;
+
+    if (!BACKEND->init()) {
+        fatal_error("Failed To Create Event Loop");
+    }
 
-    char* buffer;
+    BACKEND->run();
 
-    int len = vsnprintf(NULL, 0, fmt, vargs_cpy);
+    reactor_cleanup();
 
-    buffer = (char*)malloc(len + 1);
+    return NULL;
+}
 
-    fatal_assert(buffer != NULL, "Out Of Memory");
+//
+// Benchmark
+//
 
-    vsnprintf(buffer, len + 1, fmt, vargs);
+#define BENCH_PATH "bench.db"
+#define BENCH_GROUP 64
 
-    int ret = send(pclient->sock_fd, buffer, len, MSG_DONTWAIT);
+const char* BENCH_SYMBOLS[] = { "AAPL", "MSFT", "IBM", "AMZN", "TSLA", "NVDA", "META", "INTC" };
 
-    free(buffer);
+void bench_remove() {
+    const char* suffixes[] = { "", "-wal", "-shm", "-journal" };
 
-    if (ret <= 0 && !FD_WOULDBLOCK) {
-        log_inet(pclient->addr, "Failed To Send Data: %s", strerror(errno));
-        client_remove(pclient);
-        free(pclient);
+    for (size_t i = 0; i != LENGTHOF(suffixes); i++) {
+        char* path = format("%s%s", BENCH_PATH, suffixes[i]);
+        unlink(path);
+        free(path);
     }
-
-    va_end(vargs);
 }
 
-void client_recv(
-    client_t* pclient
+// writes buys through the journal into a scratch database under `profile`,
+// `group` trades to a flush. returns trades per second
+double bench_run(
+    const profile_t* profile,
+    int trades,
+    int group
 ) {
-    if (pclient == NULL) {
-        return;
-    }
+    bench_remove();
+    db_open(BENCH_PATH, profile);
 
-    char in_buffer[1024];
+    uint64_t start = monotonic_us();
 
-    int ret = recv(pclient->sock_fd, in_buffer, LENGTHOF(in_buffer) - 1, MSG_DONTWAIT);
+    for (int i = 0; i < trades; i += group) {
+        journal_entry_t* entries = NULL;
 
-    if (ret <= 0) {
-        if (!FD_WOULDBLOCK) {
-            log_inet(pclient->addr, "Failed To Recieve Data: %s", strerror(errno));
-            client_remove(pclient);
-            free(pclient);
+        for (int j = MIN(group, trades - i); j != 0; j--) {
+            journal_entry_t* entry = journal_entry(false, 2, 
+                BENCH_SYMBOLS[(i + j) % LENGTHOF(BENCH_SYMBOLS)], FIXED_SCALE, FIXED_SCALE);
+
+            entry->next = entries;
+            entries = entry;
         }
 
-        return;
+        journal_apply(entries);
+
+        while (entries != NULL) {
+            journal_entry_t* next = entries->next;
+            free(entries);
+            entries = next;
+        }
     }
 
-    // ensure null char
-    in_buffer[ret] = '\0';
+    uint64_t elapsed = MAX(monotonic_us() - start, 1);
+
+    db_close();
+    store_free();
+    bench_remove();
+
+    return trades * 1000000.0 / elapsed;
+}
+
+// durable trades per second under every profile, flushed alone and in batches
+void benchmark() {
+    // every run opens a fresh database, only the table is worth printing
+    LOG_LEVEL = MAX(LOG_LEVEL, LOG_WARN);
+
+    printf("%-10s %14s %14s\n", "profile", "per trade", "grouped");
 
-    client_handle(pclient, in_buffer, ret);
+    for (size_t i = 0; i != LENGTHOF(PROFILES); i++) {
+        double single = bench_run(&PROFILES[i], BENCH_TRADES, 1);
+        double grouped = bench_run(&PROFILES[i], BENCH_TRADES, BENCH_GROUP);
+
+        printf("%-10s %12.0f/s %12.0f/s\n", PROFILES[i].name, single, grouped);
+    }
 }
 
 //
@@ -708,35 +3829,26 @@ void client_recv(
 void initialize() {
     // Globals
 
-    CLIENT_LIST = NULL;
     RUNNING = true;
 
-    // Server Socket
+    // a peer vanishing mid-writev is handled where the write fails
+    signal(SIGPIPE, SIG_IGN);
 
-    if ((SERVER_FD = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) < 0) {
-        fatal_error("Failed To Create Server Socket");        
-    }
+    command_index();
 
-    sockaddr_in server_addr = { 0 };
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = INADDR_ANY;
+    // Server Sockets
 
-    if (bind(SERVER_FD, (sockaddr*)&server_addr, sizeof(sockaddr)) < 0) {
-        fatal_error("Failed To Bind Server Socket");
-    }
+    REACTORS = (reactor_t*)calloc(REACTOR_COUNT, sizeof(reactor_t));
 
-    log_ns("Init", "Server Bound To Port %hu", SERVER_PORT);
+    fatal_assert(REACTORS != NULL, "Out Of Memory");
 
-    if (listen(SERVER_FD, SOMAXCONN) < 0) {
-        fatal_error("Failed To Listen On Server Socket");
+    for (int i = 0; i != REACTOR_COUNT; i++) {
+        REACTORS[i].id = i;
+        reactor_listen(&REACTORS[i]);
     }
 
-    log_ns("Init", "Server Is Listening...");
-
-    if (fcntl(SERVER_FD, F_SETFL, fcntl(SERVER_FD, F_GETFL) | O_NONBLOCK) == -1) {
-        fatal_error("Failed To Put Server Socket Into Non-Blocking Mode");
-    }
+    log_ns("Init", "Server Bound To Port %hu", SERVER_PORT);
+    log_ns("Init", "Server Is Listening On %d Reactors...", REACTOR_COUNT);
 
     // Broadcast Socket
 
@@ -752,100 +3864,265 @@ void initialize() {
     log_ns("Init", "Broadcast Socket Created");
 
     // setup database
-    
-    sqlite3_open("system.db", &DATABASE);
-    char* error_msg = NULL;
 
-    if (DATABASE == NULL) {
-        fatal_error("Failed To Open SQLite Database");
-    }
+    db_open("system.db", PROFILE);
 
-    if (sqlite3_exec(DATABASE, USERS_CREATE_QUERY, NULL, 0, &error_msg) != SQLITE_OK) {
-        sqlite3_free(error_msg);
-    }
+    log_ns("Init", "Database Connected (%s)", PROFILE->name);
 
-    if (sqlite3_exec(DATABASE, STOCKS_CREATE_QUERY, NULL, 0, &error_msg) != SQLITE_OK) {
-        sqlite3_free(error_msg);
-    }
+    store_load();
+    journal_start();
 
-    log_ns("Init", "Database Connected");
+    log_ns("Init", "Accounts Loaded");
 
-    if (db_user_count() == 0) {
-        db_add_user("Nathan", "Morris", "nmorrisk", "password", 1000.0);
-        db_add_user("Jeffery", "Epstein", "FinanceKing16", "ilovekids", 10000000.0);
-        db_add_user("Robert", "Kelley", "RKelly", "goldenshowers", 100000.0);
-    }
+    // startup failures are fatal and print straight away, from here on
+    // records go through the log thread
+
+    log_start();
 }
 
 void deinitialize() {
-    // clean any clients
+    // every reactor has stopped logging by now
+
+    log_stop();
+
+    // the flusher may still wake reactors that have already stopped, their
+    // wake fds are only closed once it is gone
+
+    journal_stop();
+    store_free();
 
-    client_t* iter = CLIENT_LIST;
-    client_t* next;
+    log_ns("DeInit", "Journal Flushed");
 
-    while (iter != NULL) {
-        next = iter->next;
-        close(iter->sock_fd);
-        free(iter);
-        iter = next;
+    // reactors have cleaned up their own clients and listeners by now
+
+    for (int i = 0; i != REACTOR_COUNT; i++) {
+        close(REACTORS[i].wake_fd);
     }
 
+    free(REACTORS);
+    free(ADDR_TABLE);
+
     log_ns("DeInit", "Clients Freed");
 
     // clean sockets
 
-    close(SERVER_FD);
     close(BROADCAST_FD);
     
     log_ns("DeInit", "Sockets Closed");
 
     // close database
 
-    sqlite3_close(DATABASE);
+    db_close();
 
     log_ns("DeInit", "Database Disconnected");
 }
 
-int main() {
-    initialize();
+void usage(
+    const char* program
+) {
+    printf("Usage: %s [-b backend] [-t threads] [-g usec] [-p profile] [-B trades] [-l level] [-s n]\n"
+        "       [-m clients] [-M clients] [-a rate] [-i seconds]\n", program);
+    printf("\t-b backend   event loop backend, one of:");
+    
+    for (size_t i = 0; i != LENGTHOF(BACKENDS); i++) {
+        printf(" %s", BACKENDS[i].name);
+    }
+
+    printf(" (default %s)\n", BACKENDS[0].name);
+    printf("\t-t threads   reactor threads accepting on the port (default one per core)\n");
+    printf("\t-g usec      let trades gather this long before each journal flush (default 0)\n");
+    printf("\t-p profile   database durability profile, one of:");
 
-    //
+    for (size_t i = 0; i != LENGTHOF(PROFILES); i++) {
+        printf(" %s", PROFILES[i].name);
+    }
 
-    clock_t last = 0;
-    clock_t now = 0;
+    printf(" (default %s)\n", PROFILES[0].name);
+    printf("\t-B trades    time that many trades under every profile, then exit\n");
+    printf("\t-l level     least severe records logged, one of:");
 
-    while (RUNNING) {
-        // send a heartbeat every 3 seconds
+    for (size_t i = 0; i != LENGTHOF(LOG_LEVELS); i++) {
+        printf(" %s", LOG_LEVELS[i]);
+    }
+
+    printf(" (default %s)\n", LOG_LEVELS[LOG_INFO]);
+    printf("\t-s n         log one in every n records below warn (default 1)\n");
+    printf("\t-m clients   most connections open at once, 0 for no limit (default 0)\n");
+    printf("\t-M clients   most connections from one address, 0 for no limit (default 0)\n");
+    printf("\t-a rate      most connections accepted per second, 0 for no limit (default 0)\n");
+    printf("\t-i seconds   close connections silent this long, 0 to never (default 0)\n");
+}
+
+void parse_args(
+    int argc,
+    char** argv
+) {
+    int opt;
+
+    BACKEND = &BACKENDS[0];
+    PROFILE = &PROFILES[0];
+    REACTOR_COUNT = MAX(1, (int)sysconf(_SC_NPROCESSORS_ONLN));
+
+    while ((opt = getopt(argc, argv, "b:t:g:p:B:l:s:m:M:a:i:h")) != -1) {
+        switch (opt) {
+        case 'b':
+            BACKEND = NULL;
+
+            for (size_t i = 0; i != LENGTHOF(BACKENDS); i++) {
+                if (strcmp(BACKENDS[i].name, optarg) == 0) {
+                    BACKEND = &BACKENDS[i];
+                }
+            }
+
+            if (BACKEND == NULL) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 't':
+            REACTOR_COUNT = atoi(optarg);
+
+            if (REACTOR_COUNT <= 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'g':
+            JOURNAL_WINDOW_US = atoll(optarg);
+
+            if (JOURNAL_WINDOW_US < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'p':
+            PROFILE = NULL;
+
+            for (size_t i = 0; i != LENGTHOF(PROFILES); i++) {
+                if (strcmp(PROFILES[i].name, optarg) == 0) {
+                    PROFILE = &PROFILES[i];
+                }
+            }
+
+            if (PROFILE == NULL) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'B':
+            BENCH_TRADES = atoi(optarg);
+
+            if (BENCH_TRADES <= 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'l':
+            LOG_LEVEL = -1;
+
+            for (size_t i = 0; i != LENGTHOF(LOG_LEVELS); i++) {
+                if (strcmp(LOG_LEVELS[i], optarg) == 0) {
+                    LOG_LEVEL = (int)i;
+                }
+            }
+
+            if (LOG_LEVEL < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 's':
+            LOG_SAMPLE = atoi(optarg);
+
+            if (LOG_SAMPLE <= 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'm':
+            MAX_CLIENTS = atoi(optarg);
+
+            if (MAX_CLIENTS < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'M':
+            MAX_CLIENTS_PER_ADDR = atoi(optarg);
 
-        if (((now = clock()) - last) / CLOCKS_PER_SEC >= 3) {
-            heartbeat();
-            last = now;
+            if (MAX_CLIENTS_PER_ADDR < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'a':
+            ACCEPT_RATE = atoi(optarg);
+
+            if (ACCEPT_RATE < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        case 'i':
+            IDLE_TIMEOUT_US = atoll(optarg) * 1000000;
+
+            if (IDLE_TIMEOUT_US < 0) {
+                usage(argv[0]);
+                exit(1);
+            }
+            break;
+        default:
+            usage(argv[0]);
+            exit(opt != 'h');
         }
+    }
+}
+
+int main(
+    int argc,
+    char** argv
+) {
+    parse_args(argc, argv);
 
-        // check if a client is connecting
+    if (BENCH_TRADES != 0) {
+        benchmark();
+        return 0;
+    }
 
-        sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(sockaddr);
-        int client_fd = accept(SERVER_FD, (sockaddr*)&client_addr, &client_addr_len);        
+    initialize();
 
-        if (client_fd >= 0) {
-            client_accept(client_fd, &client_addr);
-        } 
-        else if (!FD_WOULDBLOCK) {
-            fatal_error("Failed To Accept Client");
+    // the main thread runs the first reactor, it settles the backend before
+    // the rest start. the preferred one may be missing from this kernel, epoll never is
+
+    REACTOR = &REACTORS[0];
+
+    if (!BACKEND->init()) {
+        log_ns_at(LOG_WARN, "Init", "Backend %s Unavailable: %s", BACKEND->name, strerror(errno));
+
+        BACKEND = &BACKENDS[0];
+
+        if (!BACKEND->init()) {
+            fatal_error("Failed To Create Event Loop");
         }
+    }
 
-        // loop through clients 
+    log_ns("Init", "Event Loop Created (%s)", BACKEND->name);
 
-        client_t* iter = CLIENT_LIST;
+    timer_arm(&HEARTBEAT_TIMER, monotonic_us());
 
-        while (iter != NULL) {
-            client_recv(iter);
-            iter = iter->next;
+    for (int i = 1; i != REACTOR_COUNT; i++) {
+        if (pthread_create(&REACTORS[i].thread, NULL, reactor_thread, &REACTORS[i]) != 0) {
+            fatal_error("Failed To Start Reactor Thread");
         }
     }
 
-    //
+    BACKEND->run();
+
+    reactor_cleanup();
+
+    for (int i = 1; i != REACTOR_COUNT; i++) {
+        pthread_join(REACTORS[i].thread, NULL);
+    }
 
     deinitialize();
-}
\ No newline at end of file
+}
@@ -77,4 +77,112 @@ char* format(
     char* fmtd = vformat(fmt, vargs);
     va_end(vargs);
     return fmtd;
-}
\ No newline at end of file
+}
+
+bool fixed_parse(
+    const char* text,
+    fixed_t* pvalue
+) {
+    bool negative = (*text == '-');
+
+    if (*text == '-' || *text == '+') {
+        text++;
+    }
+
+    if (!isdigit((unsigned char)*text)) {
+        return false;
+    }
+
+    fixed_t whole = 0;
+
+    while (isdigit((unsigned char)*text)) {
+        if (__builtin_mul_overflow(whole, 10, &whole) || 
+            __builtin_add_overflow(whole, *text - '0', &whole)) {
+            return false;
+        }
+
+        text++;
+    }
+
+    fixed_t frac = 0;
+    fixed_t place = FIXED_SCALE;
+
+    if (*text == '.') {
+        text++;
+
+        while (isdigit((unsigned char)*text)) {
+            if (place == 1) {
+                return false;
+            }
+
+            place /= 10;
+            frac += (*text - '0') * place;
+            text++;
+        }
+    }
+
+    if (*text != '\0' || __builtin_mul_overflow(whole, FIXED_SCALE, &whole) || 
+        __builtin_add_overflow(whole, frac, &whole)) {
+        return false;
+    }
+
+    *pvalue = negative ? -whole : whole;
+
+    return true;
+}
+
+size_t fixed_format(
+    fixed_t value,
+    char* text
+) {
+    char digits[FIXED_TEXT_MAX];
+    char* front = digits + sizeof(digits);
+
+    // the digits come out back to front
+
+    uint64_t magnitude = value < 0 ? -(uint64_t)value : (uint64_t)value;
+    uint64_t cents = (magnitude + FIXED_SCALE / 200) / (FIXED_SCALE / 100);
+    bool negative = value < 0 && cents != 0;
+
+    *--front = '0' + cents % 10;
+    *--front = '0' + cents / 10 % 10;
+    *--front = '.';
+
+    cents /= 100;
+
+    do {
+        *--front = '0' + cents % 10;
+        cents /= 10;
+    } while (cents != 0);
+
+    if (negative) {
+        *--front = '-';
+    }
+
+    size_t len = digits + sizeof(digits) - front;
+    memcpy(text, front, len);
+
+    return len;
+}
+
+bool fixed_mul(
+    fixed_t a,
+    fixed_t b,
+    bool round_up,
+    fixed_t* pvalue
+) {
+    __int128 product = (__int128)a * b;
+    __int128 quotient = product / FIXED_SCALE;
+
+    if (round_up && quotient * FIXED_SCALE < product) {
+        quotient++;
+    }
+
+    if (quotient > INT64_MAX || quotient < INT64_MIN) {
+        return false;
+    }
+
+    *pvalue = (fixed_t)quotient;
+
+    return true;
+}
@@ -1,17 +1,30 @@
+#define _GNU_SOURCE
+
 #include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <memory.h>
+#include <strings.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
 #include <netinet/in.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <ctype.h>
 #include <errno.h>
+#include <signal.h>
 #include <pthread.h>
+#include <endian.h>
 
 #include "sqlite3.h"
 
@@ -37,6 +50,77 @@ typedef struct sockaddr sockaddr;
 typedef struct sockaddr_in sockaddr_in;
 typedef struct timeval timeval;
 
+// dollars and shares, counted in millionths so sums are exact
+typedef int64_t fixed_t;
+
+#define FIXED_SCALE 1000000
+
+// longest fixed_format output, sign and terminator included
+#define FIXED_TEXT_MAX 32
+
+// reply codes shared by both protocols, the text protocol spells them out
+#define STATUS_OK 200
+#define STATUS_INVALID_COMMAND 400
+#define STATUS_NO_USER 401
+#define STATUS_NO_BALANCE 402
+#define STATUS_FORMAT_ERROR 403
+#define STATUS_NO_STOCK 404
+
+/*
+Binary protocol. A connection switches to it once the text command "binary"
+has been answered, from then on both ways carry frames only. A frame is a
+frame_header_t and `length` bytes of body, every integer little endian and
+every amount a fixed_t. Replies echo the opcode and request_id of the
+request they answer and carry one of the STATUS_ codes, bodies are only
+sent with STATUS_OK.
+
+    OP_BUY, OP_SELL   frame_trade_t   -> nothing
+    OP_LIST           frame_user_t    -> frame_holding_t and symbol, repeated
+    OP_BALANCE        frame_user_t    -> frame_balance_t
+    OP_SHUTDOWN       nothing         -> nothing
+    OP_QUIT           nothing         -> nothing
+*/
+
+#define OP_BUY 1
+#define OP_SELL 2
+#define OP_LIST 3
+#define OP_BALANCE 4
+#define OP_SHUTDOWN 5
+#define OP_QUIT 6
+#define OP_COUNT 7
+
+#define FRAME_MAX_BODY 4096
+#define FRAME_SYMBOL_LEN 16
+
+typedef struct __attribute__((packed)) _frame_header_t {
+    uint32_t length;
+    uint16_t opcode;
+    uint16_t status;
+    uint32_t request_id;
+} frame_header_t;
+
+// symbol is NUL padded, a symbol using all of it goes without
+typedef struct __attribute__((packed)) _frame_trade_t {
+    int64_t amount;
+    int64_t price;
+    int32_t user_id;
+    char symbol[FRAME_SYMBOL_LEN];
+} frame_trade_t;
+
+typedef struct __attribute__((packed)) _frame_user_t {
+    int32_t user_id;
+} frame_user_t;
+
+typedef struct __attribute__((packed)) _frame_balance_t {
+    int64_t balance;
+} frame_balance_t;
+
+// followed by symbol_len bytes of symbol
+typedef struct __attribute__((packed)) _frame_holding_t {
+    int64_t balance;
+    uint16_t symbol_len;
+} frame_holding_t;
+
 void _fatal_error(
     const char* message,
     const char* file,
@@ -62,4 +146,27 @@ char* vformat(
 char* format(
     const char* fmt,
     ...
-);
\ No newline at end of file
+);
+
+// reads a plain decimal such as "12" or "0.125", up to six places. fails on
+// anything else rather than round
+bool fixed_parse(
+    const char* text,
+    fixed_t* pvalue
+);
+
+// value rounded to the cent, e.g. "-12.50", into `text` which holds at least
+// FIXED_TEXT_MAX bytes. returns the length, the text is not terminated
+size_t fixed_format(
+    fixed_t value,
+    char* text
+);
+
+// a * b, false if it overflows. `round_up` picks the direction for the
+// digits past the sixth place
+bool fixed_mul(
+    fixed_t a,
+    fixed_t b,
+    bool round_up,
+    fixed_t* pvalue
+);